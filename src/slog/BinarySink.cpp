@@ -21,4 +21,16 @@ void BinarySink::record(LogRecord const& rec)
     fflush(mfile);
 }
 
+void BinarySink::format(LogRecord const& rec, FormatBuffer& out)
+{
+    mformat(out.file(), rec);
+}
+
+void BinarySink::write_formatted(LogRecord const&, char const* bytes, std::size_t size)
+{
+    open_or_rotate();
+    if (nullptr == mfile) { return; }
+    mbytesWritten += fwrite(bytes, sizeof(char), size, mfile);
+}
+
 }  // namespace slog
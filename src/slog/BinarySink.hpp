@@ -26,5 +26,11 @@ class BinarySink : public FileSink {
 
     /// Write the record to the file
     void record(LogRecord const& node) override;
+
+    /// Format a record for write_formatted() (no line break)
+    void format(LogRecord const& node, FormatBuffer& out) override;
+
+    /// Write a formatted record to the file (never echoed)
+    void write_formatted(LogRecord const& node, char const* bytes, std::size_t size) override;
 };
 }  // namespace slog
\ No newline at end of file
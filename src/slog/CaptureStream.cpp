@@ -3,6 +3,7 @@
 
 #if SLOG_STREAM_LOG
 #include <ios>
+#include <cstdio>
 #include <cstring>
 #include <cassert>
 #include <ostream>
@@ -128,8 +129,17 @@ NullStream s_null;                   // Since NullStream has no state, all threa
 } // namespace
 
 CaptureStream::CaptureStream(LogRecord* node)
-: inserter(node)
+: CaptureStream(node, Admission{nullptr, 0})
 {
+}
+
+CaptureStream::CaptureStream(LogRecord* node, Admission admission)
+: inserter(node),
+  suppressed(admission.suppressed)
+{
+    if (nullptr == node && admission.site) {
+        admission.site->readmit(admission.suppressed); // Report it with the next one instead
+    }
     if (node) {
         st_stream.stream_direct().set_inserter(&inserter);
         stream_ptr = &st_stream.stream();
@@ -144,6 +154,11 @@ CaptureStream::~CaptureStream()
 {
     if (stream_ptr != &s_null) {        
         st_stream.stream_direct().release_inserter();
+        if (suppressed > 0) {
+            char suffix[32];
+            int length = snprintf(suffix, sizeof(suffix), " [%ld suppressed]", suppressed);
+            inserter.write(suffix, length);
+        }
     }
 }
 
@@ -14,6 +14,25 @@ class ConsoleSink : public LogSink {
     /// Write a record to the console
     void record(LogRecord const& rec) override;
 
+    /// Flush stdout
+    void flush() override { fflush(stdout); }
+
+    /// ConsoleSink supports parallel formatting
+    bool can_format_in_parallel() const override { return true; }
+
+    /// Format a record (and its line break) for write_formatted()
+    void format(LogRecord const& rec, FormatBuffer& out) override
+    {
+        mformat(out.file(), rec);
+        fputc('\n', out.file());
+    }
+
+    /// Write a formatted record to stdout
+    void write_formatted(LogRecord const&, char const* bytes, std::size_t size) override
+    {
+        fwrite(bytes, sizeof(char), size, stdout);
+    }
+
     /// Change the metadata formatting
     void set_formatter(Formatter format) { mformat = format; }
 
@@ -39,6 +39,24 @@ void FileSink::finalize()
     close_file();
 }
 
+void FileSink::flush()
+{
+    if (mfile) {
+        fflush(mfile);
+    }
+    if (mecho) {
+        fflush(stdout);
+    }
+}
+
+void FileSink::sync()
+{
+    flush();
+    if (mfile && !sync_file_data(fileno(mfile))) {
+        fprintf(stderr, "Slog: could not sync log file %s\n", mfullLogName);
+    }
+}
+
 void FileSink::close_file()
 {
     if (mfile) {
@@ -114,6 +132,22 @@ void FileSink::record(LogRecord const& rec)
     }
 }
 
+void FileSink::format(LogRecord const& rec, FormatBuffer& out)
+{
+    mformat(out.file(), rec);
+    fputc('\n', out.file());
+}
+
+void FileSink::write_formatted(LogRecord const&, char const* bytes, std::size_t size)
+{
+    open_or_rotate();
+    if (nullptr == mfile) { return; }
+    mbytesWritten += fwrite(bytes, sizeof(char), size, mfile);
+    if (mecho) {
+        fwrite(bytes, sizeof(char), size, stdout);
+    }
+}
+
 void FileSink::set_file_header_format(LogFileFurniture headerFormat)
 {
     mheader = headerFormat;
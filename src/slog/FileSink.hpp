@@ -31,6 +31,16 @@ class FileSink : public LogSink
      */
     void finalize() override;
 
+    /**
+     * @brief Flush the open file (and the console, if echoing).
+     */
+    void flush() override;
+
+    /**
+     * @brief Flush, then fdatasync the open file.
+     */
+    void sync() override;
+
     /**
      * @brief The header is inserted into each log file before any records.
      */
@@ -44,6 +54,15 @@ class FileSink : public LogSink
     /// Write the record to the file
     virtual void record(LogRecord const& node) override;
 
+    /// FileSink supports parallel formatting
+    bool can_format_in_parallel() const override { return true; }
+
+    /// Format a record (and its line break) for write_formatted()
+    void format(LogRecord const& node, FormatBuffer& out) override;
+
+    /// Write a formatted record to the file (and console, if echoing)
+    void write_formatted(LogRecord const& node, char const* bytes, std::size_t size) override;
+
     /// Change the formatting for each record
     void set_formatter(Formatter format) { mformat = format; }
 
@@ -0,0 +1,111 @@
+#include "FormatPool.hpp"
+
+namespace slog
+{
+
+FormatPool::FormatPool(int helper_count)
+    : generation(0),
+      open(false),
+      quitting(false),
+      busy(0),
+      sink(nullptr),
+      records(nullptr),
+      count(0),
+      next(0)
+{
+    for (int i = 0; i < helper_count; i++) {
+        helpers.emplace_back([this]() { help(); });
+    }
+}
+
+FormatPool::~FormatPool()
+{
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        quitting = true;
+    }
+    started.notify_all();
+    for (std::thread& helper : helpers) {
+        helper.join();
+    }
+}
+
+void FormatPool::run(LogSink& sink_, LogRecord* const* records_, std::size_t count_)
+{
+    while (slots.size() < count_) {
+        slots.emplace_back(new Slot);
+    }
+    for (std::size_t i = 0; i < count_; i++) {
+        slots[i]->ready.store(false, std::memory_order_relaxed);
+    }
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        sink = &sink_;
+        records = records_;
+        count = count_;
+        next.store(0);
+        // Waking helpers isn't worth it for a single record
+        open = count_ > 1 && !helpers.empty();
+        generation++;
+    }
+    if (open) {
+        started.notify_all();
+    }
+
+    for (std::size_t i = 0; i < count_; i++) {
+        Slot& slot = *slots[i];
+        std::size_t unclaimed = i;
+        if (next.compare_exchange_strong(unclaimed, i + 1)) {
+            format_slot(i);
+        } else {
+            while (!slot.ready.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        }
+        sink_.write_formatted(*records_[i], slot.buffer.data(), slot.buffer.size());
+    }
+
+    // Don't reuse the slots until every helper has left the batch
+    std::unique_lock<std::mutex> guard(lock);
+    open = false;
+    finished.wait(guard, [this]() { return busy == 0; });
+}
+
+void FormatPool::help()
+{
+    unsigned long seen = 0;
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        started.wait(guard, [this, &seen]() { return quitting || (open && generation != seen); });
+        if (quitting) {
+            return;
+        }
+        seen = generation;
+        busy++;
+        guard.unlock();
+        format_claimed();
+        guard.lock();
+        if (--busy == 0) {
+            finished.notify_all();
+        }
+    }
+}
+
+void FormatPool::format_claimed()
+{
+    for (std::size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+        format_slot(i);
+    }
+}
+
+void FormatPool::format_slot(std::size_t index)
+{
+    Slot& slot = *slots[index];
+    slot.buffer.clear();
+    if (slot.buffer.ok()) {
+        sink->format(*records[index], slot.buffer);
+    }
+    slot.ready.store(true, std::memory_order_release);
+}
+
+} // namespace slog
@@ -0,0 +1,73 @@
+#pragma once
+#include "LogRecord.hpp"
+#include "LogSink.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace slog
+{
+
+/**
+ * @brief Helper threads that format a channel's records in parallel while the
+ * worker writes them in order. See LogConfig::set_format_threads().
+ *
+ * For each batch, the helpers and the worker claim records in order from a
+ * shared counter. The worker writes record i as soon as it is formatted,
+ * formatting it itself if no helper has claimed it yet, so output order never
+ * changes and the worker is never idle while records are unclaimed.
+ */
+class FormatPool
+{
+  public:
+    /// Start helper_count helper threads
+    explicit FormatPool(int helper_count);
+
+    /// Join the helpers
+    ~FormatPool();
+
+    FormatPool(FormatPool const&) = delete;
+    FormatPool& operator=(FormatPool const&) = delete;
+
+    /**
+     * @brief Format count records with sink.format(), then pass each to
+     * sink.write_formatted() in order. Called by the worker thread.
+     */
+    void run(LogSink& sink, LogRecord* const* records, std::size_t count);
+
+  private:
+    struct Slot {
+        FormatBuffer buffer;
+        std::atomic<bool> ready;
+    };
+
+    /// Helper thread loop
+    void help();
+
+    /// Format the records claimed from the shared counter
+    void format_claimed();
+
+    void format_slot(std::size_t index);
+
+    std::mutex lock;
+    std::condition_variable started;  // A batch opened, or quitting
+    std::condition_variable finished; // A helper left a batch
+    std::vector<std::thread> helpers;
+    std::vector<std::unique_ptr<Slot>> slots;
+    unsigned long generation; // Batches run so far
+    bool open;                // Helpers may join the current batch
+    bool quitting;
+    int busy; // Helpers inside the current batch
+
+    // The current batch. Set under lock, read by helpers that joined it.
+    LogSink* sink;
+    LogRecord* const* records;
+    std::size_t count;
+    std::atomic<std::size_t> next; // Next record to claim
+};
+
+} // namespace slog
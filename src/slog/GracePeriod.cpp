@@ -0,0 +1,205 @@
+#include "GracePeriod.hpp"
+#include "PlatformUtilities.hpp"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace slog
+{
+
+namespace
+{
+/// A thread's reader state. The sequence is odd while the thread is in a section.
+struct ReaderSlot {
+    ReaderSlot()
+        : sequence(0),
+          exited(false)
+    {
+    }
+
+    std::atomic<unsigned long> sequence; // Only written by its thread
+    std::atomic<bool> exited;
+};
+
+/// An object waiting for the readers that were in a section when it was retired
+struct Retired {
+    void* object;
+    void (*deleter)(void*);
+    std::vector<std::pair<std::shared_ptr<ReaderSlot>, unsigned long>> readers;
+};
+
+struct Registry {
+    std::mutex lock;
+    std::vector<std::shared_ptr<ReaderSlot>> slots;
+    std::vector<Retired> retired;
+};
+
+Registry& registry()
+{
+    static Registry* s_registry = new Registry; // Never destroyed, as threads may outlive statics
+    return *s_registry;
+}
+
+/// With membarrier(), writers pay for the barrier and readers only need to stop the compiler reordering
+bool use_process_barrier()
+{
+    static bool const s_enabled = enable_process_barrier();
+    return s_enabled;
+}
+
+/// Order the writer's unpublish before it looks at the readers
+void writer_barrier()
+{
+    if (use_process_barrier()) {
+        process_barrier();
+    } else {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+/// Marks the thread's slot for removal when the thread exits
+struct SlotOwner {
+    ~SlotOwner();
+    std::shared_ptr<ReaderSlot> slot;
+};
+
+// Plain pointers, so sections still work in other thread_local destructors
+thread_local ReaderSlot* t_slot = nullptr;
+thread_local unsigned t_depth = 0;
+thread_local bool t_exiting = false;
+thread_local SlotOwner t_owner;
+
+SlotOwner::~SlotOwner()
+{
+    t_exiting = true;
+    if (slot) {
+        t_slot = nullptr; // A later section registers a fresh slot, which is kept
+        slot->exited.store(true, std::memory_order_relaxed);
+    }
+}
+
+/// The calling thread's slot, registered on first use
+ReaderSlot& thread_slot()
+{
+    if (nullptr == t_slot) {
+        auto slot = std::make_shared<ReaderSlot>();
+        t_slot = slot.get();
+        Registry& all = registry();
+        {
+            std::lock_guard<std::mutex> guard(all.lock);
+            all.slots.push_back(slot);
+        }
+        if (!t_exiting) {
+            t_owner.slot = std::move(slot);
+        }
+    }
+    return *t_slot;
+}
+
+/// Note the readers now in a section, other than the caller. Lock must be held.
+std::vector<std::pair<std::shared_ptr<ReaderSlot>, unsigned long>> active_readers(Registry& all)
+{
+    std::vector<std::pair<std::shared_ptr<ReaderSlot>, unsigned long>> active;
+    for (auto it = all.slots.begin(); it != all.slots.end();) {
+        unsigned long sequence = (*it)->sequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            if (it->get() != t_slot) {
+                active.emplace_back(*it, sequence);
+            }
+        } else if ((*it)->exited.load(std::memory_order_relaxed)) {
+            it = all.slots.erase(it);
+            continue;
+        }
+        ++it;
+    }
+    return active;
+}
+
+bool all_left(std::vector<std::pair<std::shared_ptr<ReaderSlot>, unsigned long>> const& readers)
+{
+    for (auto const& reader : readers) {
+        if (reader.first->sequence.load(std::memory_order_acquire) == reader.second) {
+            return false;
+        }
+    }
+    return true;
+}
+} // namespace
+
+void GracePeriod::enter()
+{
+    if (t_depth++ > 0) {
+        return;
+    }
+    std::atomic<unsigned long>& sequence = thread_slot().sequence;
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    // Make the odd sequence visible before any shared pointer is read
+    if (use_process_barrier()) {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    } else {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+void GracePeriod::leave()
+{
+    if (--t_depth > 0) {
+        return;
+    }
+    std::atomic<unsigned long>& sequence = t_slot->sequence;
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void GracePeriod::retire(void* object, void (*deleter)(void*))
+{
+    writer_barrier();
+    Registry& all = registry();
+    {
+        std::lock_guard<std::mutex> guard(all.lock);
+        all.retired.push_back(Retired{object, deleter, active_readers(all)});
+    }
+    reclaim();
+}
+
+void GracePeriod::reclaim()
+{
+    std::vector<Retired> done;
+    Registry& all = registry();
+    {
+        std::lock_guard<std::mutex> guard(all.lock);
+        for (auto it = all.retired.begin(); it != all.retired.end();) {
+            if (all_left(it->readers)) {
+                done.push_back(std::move(*it));
+                it = all.retired.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    // Deleters run unlocked, as they may retire more objects
+    for (Retired& retired : done) {
+        retired.deleter(retired.object);
+    }
+}
+
+void GracePeriod::synchronize()
+{
+    writer_barrier();
+    Registry& all = registry();
+    std::vector<std::pair<std::shared_ptr<ReaderSlot>, unsigned long>> readers;
+    {
+        std::lock_guard<std::mutex> guard(all.lock);
+        readers = active_readers(all);
+    }
+    while (!all_left(readers)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // Any reader still holding an earlier retiree was among those waited for
+    reclaim();
+}
+
+} // namespace slog
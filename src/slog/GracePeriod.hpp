@@ -0,0 +1,54 @@
+#pragma once
+
+namespace slog
+{
+
+/**
+ * @brief Deferred freeing for objects that lock-free readers may still be
+ * using (a simple form of RCU).
+ *
+ * Readers hold a ReadSection while they use a shared object. Entering one
+ * costs a thread-local store and, if the kernel lacks membarrier(), a fence.
+ * A writer first unpublishes an object, then passes it to retire(). It is
+ * deleted once every reader that might have seen it has left its section.
+ */
+class GracePeriod
+{
+  public:
+    /// Marks the calling thread as reading while in scope. Sections may nest.
+    class ReadSection
+    {
+      public:
+        ReadSection() { enter(); }
+        ~ReadSection() { leave(); }
+        ReadSection(ReadSection const&) = delete;
+        ReadSection& operator=(ReadSection const&) = delete;
+    };
+
+    /// Delete object once current readers are done. Thread safe.
+    template <class T>
+    static void retire(T* object)
+    {
+        retire(const_cast<void*>(static_cast<void const*>(object)),
+               [](void* doomed) { delete static_cast<T*>(doomed); });
+    }
+
+    /// Call deleter(object) once current readers are done. Thread safe.
+    static void retire(void* object, void (*deleter)(void*));
+
+    /// Free the retired objects whose readers are done. Never waits. Thread safe.
+    static void reclaim();
+
+    /**
+     * @brief Wait for every other reader now in a section to leave it, then
+     * free everything retired before the call. If the caller is in a section
+     * itself, objects it might still be using are left for a later reclaim().
+     */
+    static void synchronize();
+
+  private:
+    static void enter();
+    static void leave();
+};
+
+} // namespace slog
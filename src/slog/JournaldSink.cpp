@@ -1,10 +1,13 @@
 #include "JournaldSink.hpp"
+#include "LogContext.hpp"
 #include "LogRecord.hpp"
 #include "SlogError.hpp"
 #include <algorithm>
+#include <cstdarg>
 #include <cstring>
 #define SD_JOURNAL_SUPPRESS_LOCATION
 #include <string>
+#include <sys/uio.h>
 #include <systemd/sd-journal.h>
 
 namespace slog
@@ -21,10 +24,14 @@ JournaldSink::JournaldSink()
 
 JournaldSink::~JournaldSink() { delete[] message_buffer; }
 
-void JournaldSink::write_to_journal(LogRecord const& rec) const
+void JournaldSink::write_to_journal(LogRecord const& rec)
 {
     // We reserve one extra byte for the null
     message_buffer[buffer_used] = '\0';
+    if (rec.meta().context()) {
+        write_to_journal_with_context(rec);
+        return;
+    }
     // clang-format off
     sd_journal_send(
         "CODE_FUNC=%s",   rec.meta().function(),
@@ -39,6 +46,55 @@ void JournaldSink::write_to_journal(LogRecord const& rec) const
     // clang-format on   
 }
 
+void JournaldSink::add_field(char const* format, ...)
+{
+    char field[256];
+    va_list args;
+    va_start(args, format);
+    int size = vsnprintf(field, sizeof(field), format, args);
+    va_end(args);
+    fields.append(field, std::min<std::size_t>(std::max(size, 0), sizeof(field) - 1));
+    field_ends.push_back(fields.size());
+}
+
+void JournaldSink::write_to_journal_with_context(LogRecord const& rec)
+{
+    fields.clear();
+    field_ends.clear();
+    add_field("CODE_FUNC=%s", rec.meta().function());
+    add_field("CODE_FILE=%s", rec.meta().filename());
+    add_field("CODE_LINE=%d", rec.meta().line());
+    add_field("THREAD=%ld", rec.meta().thread_id());
+    add_field("TIMESTAMP=%s", misotime);
+    add_field("PRIORITY=%d", rec.meta().severity() / 100);
+    add_field("TAG=%s", rec.meta().tag());
+    rec.meta().context()->for_each([this](char const* key, char const* value) {
+        // Field names are upper case letters, digits and '_', and may not start with '_' or a digit
+        if (!(*key >= 'a' && *key <= 'z') && !(*key >= 'A' && *key <= 'Z')) {
+            fields += 'X';
+        }
+        for (char const* c = key; *c; c++) {
+            bool legal = (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '_';
+            fields += (*c >= 'a' && *c <= 'z') ? static_cast<char>(*c - 'a' + 'A') : (legal ? *c : '_');
+        }
+        fields += '=';
+        fields += value;
+        field_ends.push_back(fields.size());
+    });
+    fields += "MESSAGE=";
+    fields += message_buffer;
+    field_ends.push_back(fields.size());
+
+    std::vector<iovec> iov(field_ends.size());
+    std::size_t start = 0;
+    for (std::size_t i = 0; i < field_ends.size(); i++) {
+        iov[i].iov_base = const_cast<char*>(fields.data() + start);
+        iov[i].iov_len = field_ends[i] - start;
+        start = field_ends[i];
+    }
+    sd_journal_sendv(iov.data(), static_cast<int>(iov.size()));
+}
+
 void JournaldSink::record(LogRecord const& rec) 
 {
     rec.meta().timestamp().format_time(misotime);    
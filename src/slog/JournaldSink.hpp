@@ -1,5 +1,7 @@
 #pragma once
 #include <cstdio>
+#include <string>
+#include <vector>
 
 #include "LogSink.hpp"
 #include "LogRecord.hpp"
@@ -23,6 +25,9 @@ namespace slog {
  * - PRIORITY  Syslog-compatible log severity
  * - TAG       The tag supplied with the record
  *
+ * Each pair of the record's LogContext is added as a field as well. Keys are
+ * upper-cased and characters journald does not allow become '_', so "request-id"
+ * becomes REQUEST_ID.
  */
 class JournaldSink : public LogSink {
    public:
@@ -57,7 +62,13 @@ class JournaldSink : public LogSink {
 
    private:
     /// Write the current buffer to the journal
-    void write_to_journal(LogRecord const& rec) const;
+    void write_to_journal(LogRecord const& rec);
+
+    /// Write the current buffer to the journal with the record's context fields
+    void write_to_journal_with_context(LogRecord const& rec);
+
+    /// Append one printf-formatted "NAME=value" field to fields
+    void add_field(char const* format, ...);
 
     // Max record size we can submit to the journal
     long buffer_size;
@@ -71,6 +82,10 @@ class JournaldSink : public LogSink {
     Formatter formatter;
     // Do we echo to the console.
     bool echo;
+    // Fields for records with a context, end to end
+    std::string fields;
+    // The end of each field in fields
+    std::vector<std::size_t> field_ends;
 };
 
 }  // namespace slog
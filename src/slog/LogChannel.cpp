@@ -1,29 +1,802 @@
 #include "LogChannel.hpp"
+#include "FormatPool.hpp"
+#include "LogContext.hpp"
+#include "PlatformUtilities.hpp"
+#include "Signal.hpp"
+#include "SlogError.hpp"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <cstdio>
+#include <cstring>
+#include <thread>
 
 namespace slog
 {
 
+/// A producer thread's overflow file
+struct LogChannel::SpillFile {
+    explicit SpillFile(int fd_)
+        : fd(fd_),
+          bytes(0),
+          pending(false)
+    {
+    }
+
+    std::mutex lock;
+    int fd;
+    long bytes;                // Unreplayed bytes
+    std::atomic<bool> pending; // Set from the first spill until the worker replays the file
+};
+
+/// Scratch records handed out by empty SPILL pools. Each thread keeps its own.
+struct LogChannel::ScratchRecords {
+    ~ScratchRecords()
+    {
+        for (LogRecord* record : free) {
+            destroy_scratch(record);
+        }
+    }
+
+    /// This thread's spill file for the channel with the given serial, or nullptr
+    SpillFile* spill_file(uint64_t serial) const
+    {
+        for (auto const& entry : files) {
+            if (entry.first == serial) {
+                return entry.second;
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<LogRecord*> free;
+    std::vector<char> buffer;                           // Space to serialize records
+    std::vector<std::pair<uint64_t, SpillFile*>> files; // By channel serial, so no lock is needed
+};
+
+thread_local LogChannel::ScratchRecords LogChannel::t_scratch;
+
+/// Queued as a barrier behind a thread's last pooled record (in every lane) to
+/// replay its spill file in order
+class LogChannel::SpillReplay : public LogControl
+{
+  public:
+    SpillReplay(LogChannel* channel_, SpillFile* file_)
+        : channel(channel_),
+          file(file_)
+    {
+    }
+
+    void run() override { channel->replay(*file); }
+
+    void discard() override { channel->replay(*file, true); }
+
+  private:
+    LogChannel* channel;
+    SpillFile* file;
+};
+
+/// Worker-owned state for collapsing consecutive duplicate records
+struct LogChannel::RepeatFilter {
+    explicit RepeatFilter(long long delay_ns_)
+        : delay_ns(delay_ns_),
+          has_previous(false),
+          previous_hash(0),
+          count(0),
+          first_ns(0)
+    {
+    }
+
+    long long delay_ns; // Longest a count is held back
+    bool has_previous;
+    uint64_t previous_hash;
+    LogRecordMetadata previous;         // The last record written
+    std::vector<char> previous_message; // All parts, end to end
+    LogRecordMetadata last_repeat;      // The latest duplicate
+    uint64_t count;                     // Duplicates not yet reported
+    long long first_ns;                 // When the first unreported duplicate arrived
+};
+
+/// Worker-owned state for shedding less severe records under pressure
+struct LogChannel::LoadShedder {
+    LoadShedder(double high_water_, double low_water_, long long interval_ns_)
+        : high_water(high_water_),
+          low_water(low_water_),
+          interval_ns(interval_ns_),
+          level(0),
+          above_since_ns(0),
+          below_since_ns(0)
+    {
+    }
+
+    double high_water;        // Pressure that raises the level
+    double low_water;         // Pressure that lowers it
+    long long interval_ns;    // How long pressure must last before each step
+    int level;                // Severity bands being shed, from DBUG up
+    long long above_since_ns; // Start of the current spell over high_water, or zero
+    long long below_since_ns; // Start of the current spell under low_water, or zero
+};
+
+namespace
+{
+/// Channel serials are never reused, unlike addresses, so stale thread-local
+/// spill file entries can't match a new channel
+std::atomic<uint64_t> s_next_serial{1};
+
+/// Layout of a record in a spill file. The message bytes follow the header.
+/// Files are only read back by this process, so the string pointers stay valid.
+struct SpillHeader {
+    char const* filename;
+    char const* function;
+    LogContext const* context; // Holds a reference until replayed
+    uint64_t time;
+    unsigned long thread_id;
+    int line;
+    int severity;
+    int channel;
+    uint32_t message_bytes;
+    char tag[TAG_SIZE];
+};
+
+/// Hash a record's message a word at a time. This only needs to be cheap and
+/// to tell most different messages apart; matches are confirmed with memcmp.
+uint64_t hash_message(LogRecord const& record)
+{
+    constexpr uint64_t MIX = 0x9e3779b97f4a7c15ull;
+    uint64_t hash = 0;
+    for (LogRecord const* part = &record; part != nullptr; part = part->more()) {
+        char const* bytes = part->message();
+        std::size_t size = part->size();
+        std::size_t i = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, bytes + i, sizeof(uint64_t));
+            hash = (hash ^ word) * MIX;
+            hash ^= hash >> 29;
+        }
+        uint64_t tail = 0;
+        memcpy(&tail, bytes + i, size - i);
+        hash = (hash ^ tail ^ size) * MIX;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+/// Check if two records come from the same call site with the same tag, severity and context
+bool same_origin(LogRecordMetadata const& a, LogRecordMetadata const& b)
+{
+    return a.line() == b.line() && a.severity() == b.severity() && a.filename() == b.filename() &&
+           a.function() == b.function() && a.context() == b.context() && 0 == strncmp(a.tag(), b.tag(), TAG_SIZE);
+}
+
+/// Check if the message parts of record spell out message
+bool same_message(LogRecord const& record, std::vector<char> const& message)
+{
+    std::size_t offset = 0;
+    for (LogRecord const* part = &record; part != nullptr; part = part->more()) {
+        std::size_t size = part->size();
+        if (offset + size > message.size() || 0 != memcmp(part->message(), message.data() + offset, size)) {
+            return false;
+        }
+        offset += size;
+    }
+    return offset == message.size();
+}
+} // namespace
+
 LogChannel::LogChannel(std::shared_ptr<LogSink> sink_, ThresholdMap const& threshold_,
                        std::shared_ptr<LogRecordPool> pool_)
     : pool(pool_),
-      threshold_map(threshold_),
-      sink(sink_)
+      thresholds(threshold_),
+      sink(sink_),
+      batch_records(0),
+      batch_immediate_severity(WARN),
+      sync_severity(std::numeric_limits<int>::min()),
+      requested_format_threads(1),
+      format_threads(1),
+      unflushed(false),
+      first_drop_ns(0),
+      shedding_limit(std::numeric_limits<int>::max()),
+      spilling_threads(0),
+      serial(s_next_serial.fetch_add(1, std::memory_order_relaxed))
+{
+    for (int i = 0; i < SEVERITY_BANDS; i++) {
+        pending_drops[i].store(0, std::memory_order_relaxed);
+        reported_drops[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+LogChannel::LogChannel(std::shared_ptr<LogSink> sink_, ThresholdMap const& threshold_,
+                       std::vector<std::shared_ptr<LogRecordPool>> node_pools_)
+    : pool(node_pools_.front()),
+      node_pools(node_pools_),
+      thresholds(threshold_),
+      sink(sink_),
+      batch_records(0),
+      batch_immediate_severity(WARN),
+      sync_severity(std::numeric_limits<int>::min()),
+      requested_format_threads(1),
+      format_threads(1),
+      unflushed(false),
+      first_drop_ns(0),
+      shedding_limit(std::numeric_limits<int>::max()),
+      spilling_threads(0),
+      serial(s_next_serial.fetch_add(1, std::memory_order_relaxed))
+{
+    for (int i = 0; i < SEVERITY_BANDS; i++) {
+        pending_drops[i].store(0, std::memory_order_relaxed);
+        reported_drops[i].store(0, std::memory_order_relaxed);
+    }
+    if (node_pools.size() == 1) {
+        node_pools.clear();
+    }
+}
+
+LogChannel::~LogChannel()
+{
+    sink->finalize();
+    for (auto& file : spill_files) {
+        close_file(file->fd);
+    }
+}
+
+void LogChannel::set_threshold(char const* tag, int severity)
 {
+    std::unique_lock<std::mutex> guard(threshold_lock);
+    if (!thresholds.set(tag, severity)) {
+        slog_error("Cannot add tag \"%s\": the channel already has %lu tags\n", tag, AtomicThresholdMap::MAX_TAGS);
+    }
 }
 
-LogChannel::~LogChannel() { sink->finalize(); }
 
+void LogChannel::replace_sink(std::shared_ptr<LogSink> next)
+{
+    if (repeats) {
+        if (repeats->count) {
+            write_repeats();
+        }
+        repeats->has_previous = false;
+    }
+    sink->flush();
+    sink->finalize();
+    unflushed = false;
+    sink = std::move(next);
+    // The new sink may format in parallel where the old one couldn't (or with
+    // a different helper count), so size the pool again on first use
+    set_format_threads(requested_format_threads);
+    format_pool.reset();
+}
 
 void LogChannel::send_to_sink(LogRecord* node)
 {
     if (node) {
-        sink->record(*node);
+        if (!repeats || !is_repeat(*node)) {
+            sink->record(*node);
+        }
         pool->free(node);
     }
 }
 
+long LogChannel::pool_free_count() const
+{
+    if (node_pools.empty()) {
+        return pool->count();
+    }
+    long count = 0;
+    for (auto it = node_pools.begin(); it != node_pools.end(); ++it) {
+        // Several nodes may share a pool
+        if (std::find(node_pools.begin(), it, *it) == it) {
+            count += (*it)->count();
+        }
+    }
+    return count;
+}
+
+LogRecordPoolStats LogChannel::pool_stats() const
+{
+    if (node_pools.empty()) {
+        return pool->stats();
+    }
+    LogRecordPoolStats total = {};
+    for (auto it = node_pools.begin(); it != node_pools.end(); ++it) {
+        if (std::find(node_pools.begin(), it, *it) != it) {
+            continue;
+        }
+        LogRecordPoolStats node = (*it)->stats();
+        total.free += node.free;
+        total.in_use += node.in_use;
+        total.high_water += node.high_water;
+        total.capacity += node.capacity;
+        total.allocations += node.allocations;
+        total.discards += node.discards;
+        total.blocks += node.blocks;
+        total.blocked_ns += node.blocked_ns;
+        total.max_blocked_ns = std::max(total.max_blocked_ns, node.max_blocked_ns);
+        total.jumbo_nodes += node.jumbo_nodes;
+        total.replenishments += node.replenishments;
+        total.refusals += node.refusals;
+        total.spills += node.spills;
+        total.footprint_bytes += node.footprint_bytes;
+        total.reclaimed_bytes += node.reclaimed_bytes;
+    }
+    return total;
+}
+
+void LogChannel::maintain_pools()
+{
+    if (node_pools.empty()) {
+        pool->maintain();
+        return;
+    }
+    for (auto it = node_pools.begin(); it != node_pools.end(); ++it) {
+        if (std::find(node_pools.begin(), it, *it) == it) {
+            (*it)->maintain();
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Drop accounting
+
+namespace
+{
+long long steady_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+} // namespace
+
+constexpr int LogChannel::SEVERITY_BANDS;
+
+int LogChannel::severity_band(int severity)
+{
+    if (severity < EMER) {
+        return 0;
+    }
+    return 1 + std::min(severity / 100, SEVERITY_BANDS - 2);
+}
+
+void LogChannel::count_drop(int severity)
+{
+    pending_drops[severity_band(severity)].fetch_add(1, std::memory_order_relaxed);
+    if (first_drop_ns.load(std::memory_order_relaxed) == 0) {
+        long long expected = 0;
+        first_drop_ns.compare_exchange_strong(expected, steady_ns(), std::memory_order_relaxed);
+    }
+}
+
+uint64_t LogChannel::dropped_count(int severity, bool all_severities) const
+{
+    uint64_t count = 0;
+    for (int i = 0; i < SEVERITY_BANDS; i++) {
+        if (all_severities || i == severity_band(severity)) {
+            count += pending_drops[i].load(std::memory_order_relaxed) + reported_drops[i].load(std::memory_order_relaxed);
+        }
+    }
+    return count;
+}
+
+void LogChannel::report_drops(int channel_id)
+{
+    long long since = first_drop_ns.load(std::memory_order_relaxed);
+    if (since == 0) {
+        return;
+    }
+    LogRecord* record = local_pool().try_allocate(WARN);
+    if (nullptr == record) {
+        return; // Still exhausted. Try again later.
+    }
+    // Open the next window before collecting counts. A drop that races with
+    // this is reported now or in the next summary, but never lost.
+    first_drop_ns.store(0, std::memory_order_relaxed);
+    uint64_t counts[SEVERITY_BANDS];
+    uint64_t total = 0;
+    for (int i = 0; i < SEVERITY_BANDS; i++) {
+        counts[i] = pending_drops[i].exchange(0, std::memory_order_relaxed);
+        reported_drops[i].store(reported_drops[i].load(std::memory_order_relaxed) + counts[i],
+                                std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) {
+        record->m_pool->free(record);
+        return;
+    }
+
+    char* cursor = record->message();
+    char* end = cursor + record->capacity();
+    cursor += snprintf(cursor, end - cursor, "dropped");
+    char const* separator = " ";
+    for (int i = 0; i < SEVERITY_BANDS && cursor < end; i++) {
+        if (counts[i]) {
+            int band_severity = (i == 0 ? FATL : (i - 1) * 100);
+            cursor += snprintf(cursor, end - cursor, "%s%llu %s", separator, (unsigned long long)counts[i],
+                               severity_string(band_severity));
+            separator = " / ";
+        }
+    }
+    if (cursor < end) {
+        double seconds = (steady_ns() - since) * 1e-9;
+        cursor += snprintf(cursor, end - cursor, " records in the last %.1f s", seconds);
+    }
+    record->size(static_cast<uint32_t>(std::min(cursor, end) - record->message()));
+    record->meta().capture(__FILE__, __FUNCTION__, __LINE__, WARN, "slog", channel_id);
+    send_to_sink(record);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Duplicate coalescing
+
+void LogChannel::set_duplicate_coalescing(long max_delay_ms)
+{
+    repeats.reset(new RepeatFilter(std::max(0LL, max_delay_ms * 1000000LL)));
+}
+
+bool LogChannel::is_repeat(LogRecord const& record)
+{
+    RepeatFilter& filter = *repeats;
+    uint64_t hash = hash_message(record);
+    if (filter.has_previous && hash == filter.previous_hash && same_origin(record.meta(), filter.previous) &&
+        same_message(record, filter.previous_message)) {
+        if (0 == filter.count++) {
+            filter.first_ns = steady_ns();
+        }
+        filter.last_repeat = record.meta();
+        return true;
+    }
+    if (filter.count) {
+        write_repeats();
+    }
+    filter.has_previous = true;
+    filter.previous_hash = hash;
+    filter.previous = record.meta();
+    filter.previous_message.clear();
+    for (LogRecord const* part = &record; part != nullptr; part = part->more()) {
+        filter.previous_message.insert(filter.previous_message.end(), part->message(),
+                                       part->message() + part->size());
+    }
+    return false;
+}
+
+void LogChannel::write_repeats()
+{
+    int length = snprintf(notice_text, sizeof(notice_text), "last message repeated %llu times",
+                          (unsigned long long)repeats->count);
+    repeats->count = 0;
+    write_notice(repeats->last_repeat, length);
+}
+
+void LogChannel::report_repeats()
+{
+    if (repeats && repeats->count && steady_ns() - repeats->first_ns >= repeats->delay_ns) {
+        write_repeats();
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Load shedding
+
+void LogChannel::set_load_shedding(double high_water, double low_water, long interval_ms)
+{
+    long long interval_ns = std::max(0LL, interval_ms * 1000000LL);
+    shedder.reset(new LoadShedder(high_water, std::min(low_water, high_water), interval_ns));
+}
+
+void LogChannel::shed_load(int channel_id, long queue_depth)
+{
+    if (!shedder) {
+        return;
+    }
+    LoadShedder& state = *shedder;
+    LogRecordPoolStats stats = pool_stats();
+    if (stats.capacity <= 0) {
+        return;
+    }
+    double pressure = static_cast<double>(std::max(stats.in_use, queue_depth)) / stats.capacity;
+    long long now = steady_ns();
+    int step = 0;
+    if (pressure >= state.high_water) {
+        state.below_since_ns = 0;
+        if (0 == state.above_since_ns) {
+            state.above_since_ns = now;
+        }
+        if (now - state.above_since_ns >= state.interval_ns && state.level < SHED_LEVELS) {
+            step = 1;
+            state.above_since_ns = now;
+        }
+    } else if (pressure <= state.low_water) {
+        state.above_since_ns = 0;
+        if (0 == state.below_since_ns) {
+            state.below_since_ns = now;
+        }
+        if (now - state.below_since_ns >= state.interval_ns && state.level > 0) {
+            step = -1;
+            state.below_since_ns = now;
+        }
+    } else {
+        state.above_since_ns = state.below_since_ns = 0;
+    }
+    if (0 == step) {
+        return;
+    }
+
+    // Level 1 sheds DBUG, level 2 INFO as well, and so on. WARN is never shed.
+    state.level += step;
+    int limit = state.level > 0 ? DBUG + 100 - 100 * state.level : std::numeric_limits<int>::max();
+    shedding_limit.store(limit, std::memory_order_relaxed);
+
+    if (repeats && repeats->count) {
+        write_repeats();
+    }
+    int percent = static_cast<int>(pressure * 100 + 0.5);
+    int length;
+    if (state.level > 0) {
+        length = snprintf(notice_text, sizeof(notice_text),
+                          "load shedding: dropping records less severe than %s (%d%% of pool in use, %ld queued)",
+                          severity_string(limit - 100), percent, queue_depth);
+    } else {
+        length = snprintf(notice_text, sizeof(notice_text),
+                          "load shedding: ended (%d%% of pool in use, %ld queued)", percent, queue_depth);
+    }
+    LogRecordMetadata meta;
+    meta.capture(__FILE__, __FUNCTION__, __LINE__, WARN, "slog", channel_id);
+    write_notice(meta, length);
+}
+
+void LogChannel::write_notice(LogRecordMetadata const& meta, int length)
+{
+    if (!notice_record) {
+        notice_record.reset(new LogRecord);
+        notice_record->m_message = notice_text;
+        notice_record->m_message_max_size = sizeof(notice_text);
+    }
+    notice_record->size(static_cast<uint32_t>(std::min<std::size_t>(std::max(length, 0), sizeof(notice_text) - 1)));
+    notice_record->meta() = meta;
+    sink->record(*notice_record);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// SPILL policy
+
+LogRecord* LogChannel::scratch_record(long message_size)
+{
+    uint32_t capacity = static_cast<uint32_t>(std::max<long>(message_size, 1L));
+    LogRecord* record;
+    if (t_scratch.free.empty()) {
+        record = new LogRecord;
+        record->m_scratch = true;
+        record->m_message = new char[capacity];
+        record->m_message_max_size = capacity;
+        record->reset();
+    } else {
+        record = t_scratch.free.back();
+        t_scratch.free.pop_back();
+        if (record->m_message_max_size < capacity) {
+            delete[] record->m_message;
+            record->m_message = new char[capacity];
+            record->m_message_max_size = capacity;
+            record->reset();
+        }
+    }
+    return record;
+}
+
+void LogChannel::destroy_scratch(LogRecord* record)
+{
+    delete[] record->m_message;
+    delete record;
+}
+
+void LogChannel::release_records(LogRecord* record)
+{
+    while (record) {
+        LogRecord* more = record->m_more;
+        record->m_more = nullptr;
+        if (record->m_scratch) {
+            record->reset();
+            t_scratch.free.push_back(record);
+        } else {
+            record->m_pool->free(record);
+        }
+        record = more;
+    }
+}
+
+void LogChannel::dispose_of_record(LogRecord* record)
+{
+    if (needs_spill(record)) {
+        release_records(record);
+    } else {
+        pool->free(record);
+    }
+}
+
+bool LogChannel::this_thread_spilling()
+{
+    SpillFile const* file = t_scratch.spill_file(serial);
+    return file && file->pending.load(std::memory_order_relaxed);
+}
+
+LogChannel::SpillFile* LogChannel::own_spill_file()
+{
+    SpillFile* file = t_scratch.spill_file(serial);
+    if (file) {
+        return file;
+    }
+    int fd = open_temporary_file(local_pool().get_spill_directory().c_str());
+    if (fd < 0) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> guard(spill_lock);
+    spill_files.emplace_back(new SpillFile(fd));
+    t_scratch.files.emplace_back(serial, spill_files.back().get());
+    return spill_files.back().get();
+}
+
+LogControl* LogChannel::spill(LogRecord* record)
+{
+    // Serialize the whole jumbo chain as one message
+    std::vector<char>& buffer = t_scratch.buffer;
+    buffer.resize(sizeof(SpillHeader));
+    for (LogRecord const* part = record; part != nullptr; part = part->m_more) {
+        buffer.insert(buffer.end(), part->message(), part->message() + part->size());
+    }
+    SpillHeader header;
+    LogRecordMetadata const& meta = record->meta();
+    header.filename = meta.filename();
+    header.function = meta.function();
+    header.context = meta.context();
+    header.time = meta.time();
+    header.thread_id = meta.thread_id();
+    header.line = meta.line();
+    header.severity = meta.severity();
+    header.channel = meta.channel();
+    header.message_bytes = static_cast<uint32_t>(buffer.size() - sizeof(SpillHeader));
+    memcpy(header.tag, meta.tag(), TAG_SIZE);
+    memcpy(buffer.data(), &header, sizeof(SpillHeader));
+
+    LogControl* replay = nullptr;
+    SpillFile* file = own_spill_file();
+    if (nullptr == file) {
+        count_drop(header.severity);
+    } else {
+        std::lock_guard<std::mutex> guard(file->lock);
+        if (append_to_file(file->fd, buffer.data(), buffer.size())) {
+            file->bytes += static_cast<long>(buffer.size());
+            LogContext::acquire(header.context);
+            if (!file->pending.load(std::memory_order_relaxed)) {
+                file->pending.store(true, std::memory_order_relaxed);
+                spilling_threads.fetch_add(1, std::memory_order_relaxed);
+                replay = new SpillReplay(this, file);
+            }
+        } else {
+            slog_error("Could not write to the spill file. A record was lost.\n");
+            count_drop(header.severity);
+        }
+    }
+    release_records(record);
+    return replay;
+}
+
+void LogChannel::replay(SpillFile& file, bool dump)
+{
+    std::vector<char>& data = replay_buffer;
+    {
+        std::lock_guard<std::mutex> guard(file.lock);
+        data.resize(file.bytes);
+        long got = read_from_file(file.fd, data.data(), data.size(), 0);
+        if (got != file.bytes) {
+            slog_error("Could not read the spill file. Some records were lost.\n");
+            data.resize(std::max(got, 0L));
+        }
+        truncate_file(file.fd);
+        file.bytes = 0;
+        file.pending.store(false, std::memory_order_relaxed);
+        spilling_threads.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    if (!replay_record) {
+        replay_record.reset(new LogRecord);
+    }
+    LogRecord& record = *replay_record;
+    std::size_t offset = 0;
+    while (offset + sizeof(SpillHeader) <= data.size()) {
+        SpillHeader header;
+        memcpy(&header, data.data() + offset, sizeof(SpillHeader));
+        offset += sizeof(SpillHeader);
+        if (offset + header.message_bytes > data.size()) {
+            break;
+        }
+        // The record borrows the message bytes straight from the buffer
+        record.m_message = data.data() + offset;
+        record.m_message_max_size = header.message_bytes;
+        record.m_message_byte_count = header.message_bytes;
+        record.meta().set_data(header.filename, header.function, header.line, header.severity, header.tag,
+                               Timestamp{header.time}, header.thread_id, header.channel);
+        offset += header.message_bytes;
+        if (dump) {
+            dump_raw(header.severity, record.m_message, header.message_bytes);
+            LogContext::release(header.context);
+            continue;
+        }
+        record.meta().set_context(header.context);
+        LogContext::release(header.context);
+        if (!repeats || !is_repeat(record)) {
+            sink->record(record);
+        }
+    }
+    record.m_message = nullptr;
+    record.meta().set_context(nullptr);
+}
+
+void LogChannel::dump_raw(int severity, char const* message, uint32_t size)
+{
+    if (size > 0 && message[size - 1] == '\0') {
+        size--;
+    }
+    int fd = get_drain_fallback_fd();
+    append_to_file(fd, severity_string(severity), 4);
+    append_to_file(fd, " ", 1);
+    append_to_file(fd, message, size);
+    append_to_file(fd, "\n", 1);
+}
+
+void LogChannel::set_format_threads(int threads)
+{
+    requested_format_threads = threads;
+    format_threads = sink->can_format_in_parallel() ? std::max(1, threads) : 1;
+}
+
+void LogChannel::send_batch_to_sink(LogRecord* const* records, std::size_t count)
+{
+    if (!format_pool) {
+        format_pool.reset(new FormatPool(format_threads - 1));
+    }
+    if (repeats) {
+        // Format the unique records between repeat counts in parallel
+        unique_records.clear();
+        for (std::size_t i = 0; i < count; i++) {
+            if (repeats->count && !unique_records.empty()) {
+                format_pool->run(*sink, unique_records.data(), unique_records.size());
+                unique_records.clear();
+            }
+            if (!is_repeat(*records[i])) {
+                unique_records.push_back(records[i]);
+            }
+        }
+        format_pool->run(*sink, unique_records.data(), unique_records.size());
+    } else {
+        format_pool->run(*sink, records, count);
+    }
+    unflushed = true;
+    for (std::size_t i = 0; i < count; i++) {
+        pool->free(records[i]);
+    }
+}
+
+void LogChannel::flush()
+{
+    sink->flush();
+    unflushed = false;
+}
+
+void LogChannel::flush_if_written()
+{
+    if (unflushed) {
+        flush();
+    }
+}
+
+void LogChannel::sync()
+{
+    sink->sync();
+}
+
 void LogChannel::finalize()
 {
+    if (repeats && repeats->count) {
+        write_repeats();
+    }
     sink->finalize();
 }
 
@@ -3,11 +3,18 @@
 #include "LogRecord.hpp"
 #include "LogRecordPool.hpp"
 #include "LogSink.hpp"
+#include "PlatformUtilities.hpp"
 #include "ThresholdMap.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace slog
 {
 
+class FormatPool;
+
 /**
  * @brief Principle worker of the slog system.
  *
@@ -20,8 +27,8 @@ namespace slog
  * thread.
  *
  * Conceptually, LogChannel has two states, SETUP and RUN.
- * In SETUP, calls to set_sink(), set_threshold(), and set_pool are legal.
- * In RUN, calls to push() are legal.
+ * In SETUP, calls to set_sink() and set_pool are legal.
+ * In RUN, calls to push() are legal. Thresholds may be changed in either.
  *
  */
 class LogChannel
@@ -32,6 +39,13 @@ class LogChannel
      */
     LogChannel(std::shared_ptr<LogSink> sink, ThresholdMap const& threshold, std::shared_ptr<LogRecordPool> pool);
 
+    /**
+     * Ctor for a NUMA-aware channel. node_pools[i] serves producers running on
+     * NUMA node i. Producers on nodes without a pool use node_pools[0].
+     */
+    LogChannel(std::shared_ptr<LogSink> sink, ThresholdMap const& threshold,
+               std::vector<std::shared_ptr<LogRecordPool>> node_pools);
+
     /**
      * Dtor. Calls stop() so that all enqued messages will
      * be sent to the sink before returning.
@@ -46,18 +60,55 @@ class LogChannel
     /**
      * Check the severity threshold for the given tag. Thread safe in RUN mode.
      */
-    int threshold(char const* tag) const { return threshold_map[tag]; }
+    int threshold(char const* tag) const { return thresholds[tag]; }
+
+    /**
+     * Change the threshold for a tag (or the default threshold, if tag is null
+     * or empty). Readers never block: thresholds are changed in place. A new
+     * tag is ignored (with an error) once the channel has
+     * AtomicThresholdMap::MAX_TAGS tags. Thread safe.
+     */
+    void set_threshold(char const* tag, int severity);
+
+    /// The most verbose threshold of any tag on this channel. Thread safe.
+    int max_threshold() const { return thresholds.max_threshold(); }
+
+    /**
+     * Flush and finalize the sink, then write to next instead. Called on the
+     * worker thread.
+     */
+    void replace_sink(std::shared_ptr<LogSink> next);
 
     /**
      * Attempt to grab a new record from the pool. Will return nullptr if the
-     * pool is exhausted. Thread safe.
+     * pool is exhausted. The severity lets the pool favor important records
+     * when memory is tight. If the pool policy is SPILL, an exhausted pool
+     * yields a thread-local scratch record instead. Thread safe.
      */
-    LogRecord* get_fresh_record() { return pool->allocate(); }
+    LogRecord* get_fresh_record(int severity = FATL);
 
     /**
      * Return a record to the pool. Thread safe.
      */
-    void dispose_of_record(LogRecord* record) { pool->free(record); }
+    void dispose_of_record(LogRecord* record);
+
+    /**
+     * Check if any part of the record is a SPILL scratch record. Such records
+     * must go through spill() instead of the worker queue.
+     */
+    static bool needs_spill(LogRecord const* record);
+
+    /**
+     * @brief Append the record to the calling thread's spill file, then free it.
+     *
+     * Once a thread spills, its later records are spilled as well until the
+     * worker has replayed the file, so records from one thread stay in order.
+     * A record that can't be spilled is counted as a drop.
+     * @return An action that replays the file, to be queued with
+     * LogWorker::push_barrier() so that it runs once every lane has caught
+     * up, or nullptr if one is already queued.
+     */
+    LogControl* spill(LogRecord* record);
 
     /**
      * Send the record to the sink. Then, this function frees the
@@ -66,9 +117,129 @@ class LogChannel
     void send_to_sink(LogRecord* rec);
 
     /**
-     * @brief Obtain the number of free records in the pool
+     * @brief Obtain the number of free records in the pool (summed over all
+     * NUMA node pools)
+     */
+    long pool_free_count() const;
+
+    /**
+     * @brief Obtain the pool usage counters (summed over all NUMA node pools)
+     */
+    LogRecordPoolStats pool_stats() const;
+
+    /**
+     * @brief Run periodic pool housekeeping (replenishment and trimming).
+     * Called by the worker thread.
      */
-    long pool_free_count() const { return pool->count(); }
+    void maintain_pools();
+
+    /**
+     * @brief Note that a record of this severity was dropped because no record
+     * could be allocated. Thread safe.
+     */
+    void count_drop(int severity);
+
+    /**
+     * @brief Total records dropped, either in the severity band containing
+     * severity or (if all_severities) in every band. Thread safe.
+     */
+    uint64_t dropped_count(int severity, bool all_severities = false) const;
+
+    /**
+     * @brief If records were dropped since the last report, send a summary record
+     * to the sink. This does nothing until a record can be allocated. Called by
+     * the worker thread.
+     */
+    void report_drops(int channel_id);
+
+    /**
+     * @brief Collapse consecutive duplicate records (same message, tag,
+     * severity and call site) into the first one, followed by "last message
+     * repeated N times". The count is written when a different record arrives
+     * or after max_delay_ms. Only legal in SETUP mode.
+     */
+    void set_duplicate_coalescing(long max_delay_ms);
+
+    /**
+     * @brief If duplicates have been held back for max_delay_ms, send their
+     * count to the sink. Called by the worker thread.
+     */
+    void report_repeats();
+
+    /// Records with severity >= this are being shed. Thread safe.
+    int shed_limit() const { return shedding_limit.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Shed DBUG records, then INFO, then NOTE, one step per interval_ms
+     * while the pool or queue stays at least high_water full. Step back down
+     * once it has stayed at most low_water full as long. Only legal in SETUP
+     * mode.
+     */
+    void set_load_shedding(double high_water, double low_water, long interval_ms);
+
+    /**
+     * @brief Update the shedding level from the pool usage and queue_depth,
+     * and send a record to the sink if it changes. Called by the worker thread.
+     */
+    void shed_load(int channel_id, long queue_depth);
+
+    /**
+     * @brief Stage up to max_records records per thread before publishing
+     * them to the worker. Records with severity <= immediate_severity are
+     * published at once. Only legal in SETUP mode.
+     */
+    void set_thread_batching(int max_records, int immediate_severity)
+    {
+        batch_records = max_records;
+        batch_immediate_severity = immediate_severity;
+    }
+
+    /// Per-thread batch size (1 or less if records go straight to the queue)
+    int get_batch_records() const { return batch_records; }
+
+    /// Severity at or below which staged records are published at once
+    int get_batch_immediate_severity() const { return batch_immediate_severity; }
+
+    /**
+     * @brief Format this channel's records on up to threads threads (counting
+     * the worker), if the sink can_format_in_parallel(). Only legal in SETUP
+     * mode.
+     */
+    void set_format_threads(int threads);
+
+    /// Check if send_batch_to_sink() formats in parallel
+    bool formats_in_parallel() const { return format_threads > 1; }
+
+    /**
+     * Write count records to the sink in order, formatting them in parallel,
+     * then return them to the pool. Called by the worker thread.
+     */
+    void send_batch_to_sink(LogRecord* const* records, std::size_t count);
+
+    /**
+     * Flush the sink. Called by the worker thread.
+     */
+    void flush();
+
+    /**
+     * Flush the sink if send_batch_to_sink() has written since the last
+     * flush. Called by the worker thread once it has caught up with its queue.
+     */
+    void flush_if_written();
+
+    /**
+     * Make the sink's records durable. Called by the worker thread.
+     */
+    void sync();
+
+    /**
+     * @brief Make producers wait until records with severity <= sync_severity
+     * are written and synced. Only legal in SETUP mode.
+     */
+    void set_sync_severity(int severity) { sync_severity = severity; }
+
+    /// Severity at or below which producers wait for their records to be synced
+    int get_sync_severity() const { return sync_severity; }
 
     /**
      * Send the finalize signal to the sink
@@ -76,12 +247,123 @@ class LogChannel
     void finalize();
 
   private:
+    struct SpillFile;
+    struct ScratchRecords;
+    class SpillReplay;
+    struct RepeatFilter;
+    struct LoadShedder;
+
+    /// The pool for the NUMA node the caller is running on
+    LogRecordPool& local_pool() const;
+
+    /// Check if the calling thread has records waiting in its spill file. This
+    /// does not lock.
+    bool this_thread_spilling();
+
+    /// Find (or create) the calling thread's spill file. Returns nullptr on failure.
+    SpillFile* own_spill_file();
+
+    /// Write the contents of a spill file to the sink, or to the drain fallback
+    /// descriptor if dump is set (past the drain deadline). Called on the
+    /// worker thread.
+    void replay(SpillFile& file, bool dump = false);
+
+    /// Write a message to the drain fallback descriptor like LogWorker::dump_raw()
+    static void dump_raw(int severity, char const* message, uint32_t size);
+
+    /// Check if the record repeats the last one written. If not, write any
+    /// pending repeat count and remember the record. Called on the worker thread.
+    bool is_repeat(LogRecord const& record);
+
+    /// Send "last message repeated N times" to the sink
+    void write_repeats();
+
+    /// Send the first length bytes of notice_text to the sink with this metadata
+    void write_notice(LogRecordMetadata const& meta, int length);
+
+    /// Obtain a thread-local record for a SPILL pool that is empty
+    static LogRecord* scratch_record(long message_size);
+
+    /// Return each part of a record to its pool (or the scratch list)
+    static void release_records(LogRecord* record);
+
+    static void destroy_scratch(LogRecord* record);
+
+    static thread_local ScratchRecords t_scratch;
+
     // These object have only thread-safe calls
     std::shared_ptr<LogRecordPool> pool;
+    std::vector<std::shared_ptr<LogRecordPool>> node_pools; // Empty unless NUMA-aware
+
+    // Thresholds change in place. Changes are serialized by threshold_lock.
+    AtomicThresholdMap thresholds;
+    std::mutex threshold_lock;
 
     // This state should not be mutated in RUN mode
-    ThresholdMap threshold_map;
     std::shared_ptr<LogSink> sink;
+    int batch_records;
+    int batch_immediate_severity;
+    int sync_severity;
+    int requested_format_threads;            // As configured, before checking the sink
+    int format_threads;                      // 1 unless formatting in parallel
+    bool unflushed;                          // Worker-owned: batch writes since the last flush
+    std::unique_ptr<FormatPool> format_pool; // Started on first use by the worker
+    std::unique_ptr<RepeatFilter> repeats;    // Null unless coalescing duplicates
+    std::vector<LogRecord*> unique_records;   // Worker-owned scratch for send_batch_to_sink()
+    std::unique_ptr<LoadShedder> shedder;     // Null unless shedding load
+    std::unique_ptr<LogRecord> notice_record; // Worker-owned. Borrows notice_text.
+    char notice_text[128];
+
+    // Drop accounting. Severities are grouped in bands of 100 (FATL, EMER, ... DBUG)
+    static constexpr int SEVERITY_BANDS = 9;
+    static int severity_band(int severity);
+    std::atomic<uint64_t> pending_drops[SEVERITY_BANDS];  // Not yet reported
+    std::atomic<uint64_t> reported_drops[SEVERITY_BANDS]; // Written by the worker only
+    std::atomic<long long> first_drop_ns;                // Start of the report window, or zero
+
+    // Load shedding
+    static constexpr int SHED_LEVELS = 3; // DBUG, INFO and NOTE
+    std::atomic<int> shedding_limit;      // Written by the worker only
+
+    // SPILL policy state
+    std::atomic<int> spilling_threads; // Threads with unreplayed spill files
+    uint64_t serial;                   // Keys each thread's spill file in t_scratch
+    std::mutex spill_lock;
+    std::vector<std::unique_ptr<SpillFile>> spill_files; // One per producer thread. Owns them.
+    std::unique_ptr<LogRecord> replay_record;            // Worker-owned
+    std::vector<char> replay_buffer;                     // Worker-owned
 };
 
+inline LogRecord* LogChannel::get_fresh_record(int severity)
+{
+    LogRecordPool& local = local_pool();
+    LogRecord* record = nullptr;
+    if (spilling_threads.load(std::memory_order_relaxed) == 0 || !this_thread_spilling()) {
+        record = local.allocate(severity);
+    }
+    if (nullptr == record && local.get_policy() == SPILL) {
+        record = scratch_record(local.get_message_size());
+    }
+    return record;
+}
+
+inline bool LogChannel::needs_spill(LogRecord const* record)
+{
+    for (; record != nullptr; record = record->m_more) {
+        if (record->m_scratch) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline LogRecordPool& LogChannel::local_pool() const
+{
+    if (node_pools.empty()) {
+        return *pool;
+    }
+    unsigned node = static_cast<unsigned>(current_numa_node_index());
+    return *node_pools[node < node_pools.size() ? node : 0];
+}
+
 } // namespace slog
@@ -0,0 +1,81 @@
+#include "LogContext.hpp"
+#include "SlogError.hpp"
+#include <cstring>
+#include <new>
+
+namespace slog
+{
+
+namespace
+{
+/// The innermost open scope on this thread
+thread_local LogContext const* t_current = nullptr;
+} // namespace
+
+LogContext::LogContext(LogContext const* up_, int count_)
+    : refs(1),
+      up(up_),
+      count(count_)
+{
+}
+
+LogContext const* LogContext::current() { return t_current; }
+
+LogContext* LogContext::make(LogContext const* up, int count, std::size_t bytes)
+{
+    void* block = ::operator new(sizeof(LogContext) + 2 * count * sizeof(uint32_t) + bytes);
+    acquire(up);
+    return new (block) LogContext(up, count);
+}
+
+void LogContext::release(LogContext const* context)
+{
+    // Freeing a scope drops its reference to the enclosing one
+    while (context && context->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        LogContext const* up = context->up;
+        context->~LogContext();
+        ::operator delete(const_cast<LogContext*>(context));
+        context = up;
+    }
+}
+
+LogContextScope::LogContextScope(char const* key, char const* value)
+{
+    LogContextField field(key, value);
+    open(&field, 1);
+}
+
+LogContextScope::LogContextScope(std::initializer_list<LogContextField> fields) { open(fields.begin(), fields.size()); }
+
+void LogContextScope::open(LogContextField const* fields, std::size_t count)
+{
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        bytes += strlen(fields[i].key) + strlen(fields[i].value) + 2;
+    }
+    LogContext* next = LogContext::make(t_current, static_cast<int>(count), bytes);
+    uint32_t* offsets = next->offsets();
+    char* text = next->text();
+    uint32_t offset = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        for (char const* part : {fields[i].key, fields[i].value}) {
+            std::size_t size = strlen(part) + 1;
+            memcpy(text + offset, part, size);
+            *offsets++ = offset;
+            offset += static_cast<uint32_t>(size);
+        }
+    }
+    context = next;
+    t_current = next;
+}
+
+LogContextScope::~LogContextScope()
+{
+    if (t_current != context) {
+        slog_error("LogContextScope closed out of order\n");
+    }
+    t_current = context->parent();
+    LogContext::release(context);
+}
+
+} // namespace slog
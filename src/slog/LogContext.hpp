@@ -0,0 +1,150 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <type_traits>
+
+namespace slog
+{
+
+class LogContextScope;
+
+/**
+ * @brief An immutable set of key/value pairs, such as a request id, attached
+ * to every record logged while it is in scope (a "mapped diagnostic context").
+ *
+ * Contexts are made by LogContextScope and nest: each one adds its pairs to
+ * those of the enclosing scope. A record only holds a reference to the
+ * calling thread's current context, so nothing is formatted or copied per
+ * call. Sinks render the pairs on the worker thread. Contexts are reference
+ * counted and freed once the last record using them has been written.
+ */
+class LogContext
+{
+  public:
+    LogContext(LogContext const&) = delete;
+    LogContext& operator=(LogContext const&) = delete;
+
+    /// The number of pairs added by this scope (not counting enclosing scopes)
+    int size() const { return count; }
+
+    /// Inspect the key of pair i of this scope
+    char const* key(int i) const { return text() + offsets()[2 * i]; }
+
+    /// Inspect the value of pair i of this scope
+    char const* value(int i) const { return text() + offsets()[2 * i + 1]; }
+
+    /// The context of the enclosing scope, or nullptr
+    LogContext const* parent() const { return up; }
+
+    /// Call function(key, value) for every pair in scope, outermost first
+    template <class Function>
+    void for_each(Function function) const
+    {
+        if (up) {
+            up->for_each(function);
+        }
+        for (int i = 0; i < count; i++) {
+            function(key(i), value(i));
+        }
+    }
+
+    /// The calling thread's context, or nullptr if no LogContextScope is open
+    static LogContext const* current();
+
+    /// Take a reference to context (which may be null)
+    static void acquire(LogContext const* context)
+    {
+        if (context) {
+            context->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /// Drop a reference to context (which may be null), freeing it after the last
+    static void release(LogContext const* context);
+
+  private:
+    friend class LogContextScope;
+
+    LogContext(LogContext const* up, int count);
+
+    /// Allocate a context holding count pairs with bytes of text in one block
+    static LogContext* make(LogContext const* up, int count, std::size_t bytes);
+
+    uint32_t const* offsets() const { return reinterpret_cast<uint32_t const*>(this + 1); }
+    uint32_t* offsets() { return reinterpret_cast<uint32_t*>(this + 1); }
+    char const* text() const { return reinterpret_cast<char const*>(offsets() + 2 * count); }
+    char* text() { return reinterpret_cast<char*>(offsets() + 2 * count); }
+
+    mutable std::atomic<long> refs;
+    LogContext const* up; // Holds a reference
+    int count;
+};
+
+/**
+ * @brief One key/value pair for LogContextScope. Numbers are converted to
+ * text here, once, rather than for every record.
+ */
+class LogContextField
+{
+  public:
+    LogContextField(char const* key_, char const* value_)
+        : key(key_),
+          value(value_ ? value_ : "")
+    {
+    }
+
+    LogContextField(char const* key_, std::string const& value_)
+        : key(key_),
+          value(value_.c_str())
+    {
+    }
+
+    template <class Number, class = typename std::enable_if<std::is_arithmetic<Number>::value>::type>
+    LogContextField(char const* key_, Number value_)
+        : key(key_),
+          number(std::to_string(value_)),
+          value(number.c_str())
+    {
+    }
+
+    LogContextField(LogContextField const&) = delete;
+    LogContextField& operator=(LogContextField const&) = delete;
+
+  private:
+    friend class LogContextScope;
+
+    char const* key;
+    std::string number;
+    char const* value;
+};
+
+/**
+ * @brief Add key/value pairs to every record the calling thread logs until
+ * this object is destroyed, e.g.
+ * ```
+ * slog::LogContextScope scope{{"request", request_id}, {"user", user_id}};
+ * Slog(INFO) << "Handling request"; // Carries request and user
+ * ```
+ * The pairs are copied once, into a single allocation. Scopes must be closed
+ * in the reverse order they were opened, which their lifetimes ensure.
+ */
+class LogContextScope
+{
+  public:
+    LogContextScope(char const* key, char const* value);
+    LogContextScope(std::initializer_list<LogContextField> fields);
+    ~LogContextScope();
+
+    LogContextScope(LogContextScope const&) = delete;
+    LogContextScope& operator=(LogContextScope const&) = delete;
+
+  private:
+    void open(LogContextField const* fields, std::size_t count);
+
+    LogContext const* context;
+};
+
+} // namespace slog
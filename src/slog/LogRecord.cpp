@@ -1,4 +1,5 @@
 #include "LogRecord.hpp"
+#include "LogContext.hpp"
 #include "SlogConfig.hpp"
 
 #include <cstring>
@@ -11,7 +12,40 @@ namespace slog
 constexpr int NO_LINE = -1;
 constexpr int NO_CHANNEL = -1;
 
-LogRecordMetadata::LogRecordMetadata() { reset(); }
+LogRecordMetadata::LogRecordMetadata()
+    : m_context(nullptr)
+{
+    reset();
+}
+
+LogRecordMetadata::LogRecordMetadata(LogRecordMetadata const& other)
+    : m_context(nullptr)
+{
+    *this = other;
+}
+
+LogRecordMetadata& LogRecordMetadata::operator=(LogRecordMetadata const& other)
+{
+    memcpy(m_tag, other.m_tag, TAG_SIZE);
+    m_filename = other.m_filename;
+    m_function = other.m_function;
+    m_time = other.m_time;
+    m_thread_id = other.m_thread_id;
+    m_line = other.m_line;
+    m_severity = other.m_severity;
+    m_channelId = other.m_channelId;
+    set_context(other.m_context);
+    return *this;
+}
+
+LogRecordMetadata::~LogRecordMetadata() { LogContext::release(m_context); }
+
+void LogRecordMetadata::set_context(LogContext const* context)
+{
+    LogContext::acquire(context);
+    LogContext::release(m_context);
+    m_context = context;
+}
 
 void LogRecordMetadata::reset()
 {
@@ -21,6 +55,7 @@ void LogRecordMetadata::reset()
     m_severity = std::numeric_limits<int>::max();    
     memset(m_tag, 0, TAG_SIZE);
     m_channelId = NO_CHANNEL;
+    set_context(nullptr);
 }
 
 void LogRecordMetadata::capture(char const* filename_, char const* function_, int line_, int severity_,
@@ -36,6 +71,7 @@ void LogRecordMetadata::capture(char const* filename_, char const* function_, in
         // system calls in these cases.
         m_time = Timestamp::now();
         m_thread_id = std::hash<std::thread::id>{}(std::this_thread::get_id());
+        set_context(LogContext::current());
     }
     if (tag_) {
         strncpy(m_tag, tag_, TAG_SIZE - 1);
@@ -64,10 +100,37 @@ LogRecord::LogRecord()
 , m_message(nullptr)
 , m_more(nullptr)
 , m_next(nullptr)
+, m_pool(nullptr)
+, m_control(nullptr)
+, m_scratch(false)
+, m_completion(nullptr)
 {
     m_meta.reset();
 }
 
+LogRecord* LogRecord::make_control(int channel, LogControl* action)
+{
+    LogRecord* control = new LogRecord;
+    // Capture the time so that control records sort correctly in ordered batches
+    control->m_meta.capture("", "", 0, std::numeric_limits<int>::max(), "", channel);
+    control->m_control = action;
+    return control;
+}
+
+void LogRecord::run_control(LogRecord* control)
+{
+    control->m_control->run();
+    delete control->m_control;
+    delete control;
+}
+
+void LogRecord::discard_control(LogRecord* control)
+{
+    control->m_control->discard();
+    delete control->m_control;
+    delete control;
+}
+
 void LogRecord::reset()
 {
     m_meta.reset();    
@@ -75,6 +138,7 @@ void LogRecord::reset()
     m_message[0] = '\0';
     m_more = nullptr;
     m_next = nullptr;
+    m_completion = nullptr;
 }
 
 } // namespace slog
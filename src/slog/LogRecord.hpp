@@ -6,12 +6,38 @@
 namespace slog
 {
 
+class LogCompletion;
+class LogContext;
+class LogRecordPool;
+
+/**
+ * @brief An action run on a worker thread in queue order.
+ *
+ * Control records carry these through the record queue so that the action
+ * happens after every record queued before it.
+ */
+class LogControl
+{
+  public:
+    virtual ~LogControl() {}
+
+    /// Called on the worker thread
+    virtual void run() = 0;
+
+    /// Called instead of run() if the worker drops the record, e.g. at the
+    /// drain deadline. Release anything run() would have.
+    virtual void discard() {}
+};
+
 /**
  * @brief Metadata associated with every log message
  */
 class LogRecordMetadata {
   public:
     LogRecordMetadata();
+    LogRecordMetadata(LogRecordMetadata const& other);
+    LogRecordMetadata& operator=(LogRecordMetadata const& other);
+    ~LogRecordMetadata();
     void reset();
 
     /**
@@ -20,7 +46,8 @@ class LogRecordMetadata {
      * This assumes that filename and function are static strings in the program
      * (i.e. those produced by __FILE__ and __FUNCTION__ macros), while tag may
      * change on the caller's thread. Therefore tag is copied, but filename and
-     * function just take the pointer values.
+     * function just take the pointer values. The calling thread's LogContext
+     * is referenced, not copied.
      */
     void capture(char const* filename, char const* function, int line, int severity, char const* tag, int channel);
 
@@ -50,6 +77,12 @@ class LogRecordMetadata {
 
     int channel() const { return m_channelId; }
 
+    /// The LogContext that was current when the record was captured, or nullptr
+    LogContext const* context() const { return m_context; }
+
+    /// Refer to a different context (which may be null)
+    void set_context(LogContext const* context);
+
     /// Set all fields in the metdata
     void set_data(char const* filename, char const* function, int line, int severity, char const* tag, Timestamp time,
                   unsigned long thread_id, int channel);
@@ -78,6 +111,9 @@ class LogRecordMetadata {
 
     //! The channel this record is for
     int m_channelId;
+
+    //! Key/value pairs in scope when this was captured. Holds a reference.
+    LogContext const* m_context;
 };
 
 /**
@@ -125,11 +161,22 @@ class LogRecord
   private:
     friend class LogRecordPool;
     friend class LogWorker;
+    friend class LogChannel;
     friend class PoolMemory;
 
-    /// These are only created in LogRecordPool
+    /// These are only created in LogRecordPool (or by LogChannel for control
+    /// and scratch records)
     LogRecord();
 
+    /// Make a heap allocated control record. The record owns action.
+    static LogRecord* make_control(int channel, LogControl* action);
+
+    /// Run the action of a control record, then delete the record
+    static void run_control(LogRecord* control);
+
+    /// Discard the action of a control record, then delete the record
+    static void discard_control(LogRecord* control);
+
     /// Clean out this record
     void reset();
 
@@ -150,6 +197,18 @@ class LogRecord
 
     //! Intrusive pointer for linked lists
     LogRecord* m_next;
+
+    //! The pool this record belongs to
+    LogRecordPool* m_pool;
+
+    //! Non-null for control records, which carry an action instead of a message
+    LogControl* m_control;
+
+    //! True for thread-local records used by the SPILL pool policy
+    bool m_scratch;
+
+    //! Non-null if a producer is waiting for this record to be written and synced
+    LogCompletion* m_completion;
 };
 
 } // namespace slog
@@ -1,18 +1,55 @@
 #include "LogRecordPool.hpp"
 #include "LogRecord.hpp"
+#include "PlatformUtilities.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <cstdlib>
+#include <new>
 #include <vector>
 
 namespace slog
 {
 
+/// A thread's blocking counters for one pool, shared by the pool and the thread
+struct PoolThreadBlocking {
+    PoolThreadBlocking()
+        : stats{std::this_thread::get_id(), 0, 0, 0},
+          exited(false)
+    {
+    }
+
+    LogRecordPoolThreadStats stats; // Guarded by the pool lock
+    std::atomic<bool> exited;
+};
+
+namespace
+{
+/// Pool serials are never reused, unlike addresses, so stale thread-local
+/// entries can't match a new pool
+std::atomic<uint64_t> s_next_pool_serial{1};
+
+/// The calling thread's blocking counters, one entry per pool it has waited on
+struct BlockingSlots {
+    ~BlockingSlots()
+    {
+        for (auto const& slot : slots) {
+            slot.second->exited.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    std::vector<std::pair<uint64_t, std::shared_ptr<PoolThreadBlocking>>> slots;
+};
+
+thread_local BlockingSlots t_blocking;
+} // namespace
+
 /**
  * This holds all allocations from the heap that are in use by the
  * LogRecordPool. Each request for more memory is served by two allocations: one
- * for the records and one for the message storage in the record.
+ * for the records and one for the message storage in the record. If the pool
+ * uses MAPPED_MEMORY, both live in a single mmap() region instead.
  *
  * For BLOCK or DISCARD pools, there will only ever be one allocation. For
  * ALLOCATE pools, additional allocations can occur when the LogRecordPool is
@@ -21,121 +58,586 @@ namespace slog
 class PoolMemory
 {
   public:
+    explicit PoolMemory(int memory_flags)
+        : flags(memory_flags)
+    {
+        if (flags & HUGE_PAGES) {
+            flags |= MAPPED_MEMORY;
+        }
+    }
+
     ~PoolMemory()
     {
         for (auto& item : allocations) {
-            delete[] item.first;
-            delete[] item.second;
+            free_allocation(item);
         }
     }
 
-    std::pair<LogRecord*, char*>& allocate(uint64_t count, uint64_t message_size)
+    struct Allocation {
+        LogRecord* records;
+        char* messages;
+        uint64_t count;          // Records in the allocation
+        std::size_t bytes;       // Total footprint
+        std::size_t mapped_size; // Zero for heap allocations
+    };
+
+    /// Obtain storage for count records. On failure, records is null.
+    Allocation allocate(uint64_t count, uint64_t message_size)
     {
-        allocations.emplace_back(new LogRecord[count], new char[message_size * count]);
-        return allocations.back();
+        Allocation allocation{nullptr, nullptr, count, 0, 0};
+        if (flags & MAPPED_MEMORY) {
+            std::size_t size = count * (sizeof(LogRecord) + message_size);
+            void* memory = map_memory(&size, flags & HUGE_PAGES, flags & PREFAULT);
+            if (memory) {
+                allocation.records = static_cast<LogRecord*>(memory);
+                for (uint64_t i = 0; i < count; i++) {
+                    new (allocation.records + i) LogRecord;
+                }
+                allocation.messages = reinterpret_cast<char*>(allocation.records + count);
+                allocation.mapped_size = size;
+                allocation.bytes = size;
+            }
+        } else {
+            allocation.records = new LogRecord[count];
+            allocation.messages = new char[message_size * count];
+            allocation.bytes = count * (sizeof(LogRecord) + message_size);
+            if (flags & PREFAULT) {
+                prefault_memory(allocation.messages, message_size * count);
+            }
+        }
+        if (nullptr == allocation.records) {
+            return allocation;
+        }
+        if (flags & LOCK_MEMORY) {
+            if (allocation.mapped_size) {
+                lock_memory(allocation.records, allocation.mapped_size);
+            } else {
+                lock_memory(allocation.records, count * sizeof(LogRecord));
+                lock_memory(allocation.messages, count * message_size);
+            }
+        }
+        allocations.push_back(allocation);
+        return allocation;
+    }
+
+    /// The allocations in the order they were made
+    std::vector<Allocation> const& list() const { return allocations; }
+
+    /// Return the allocations at the given (ascending) indices to the OS
+    void release(std::vector<std::size_t> const& indices)
+    {
+        for (auto it = indices.rbegin(); it != indices.rend(); ++it) {
+            free_allocation(allocations[*it]);
+            allocations.erase(allocations.begin() + *it);
+        }
     }
 
   private:
-    std::vector<std::pair<LogRecord*, char*>> allocations;
+    static void free_allocation(Allocation& item)
+    {
+        if (item.mapped_size) {
+            // The records were built with placement new, so destroy them as delete[] would
+            for (uint64_t i = 0; i < item.count; i++) {
+                item.records[i].~LogRecord();
+            }
+            unmap_memory(item.records, item.mapped_size);
+        } else {
+            delete[] item.records;
+            delete[] item.messages;
+        }
+    }
+
+    int flags;
+    std::vector<Allocation> allocations;
 };
 
-void LogRecordPool::acquire_blank_records()
+namespace
 {
-    if (chunks == 0) { return; }
-    
-    auto& allocation = pool->allocate(chunks, message_size);
-    if (nullptr == allocation.first || nullptr == allocation.second) { // Memory exhausted
-        return;
+/// Add to a counter that is only written with the pool lock held. This avoids
+/// a locked read-modify-write instruction.
+template <class T> void bump(std::atomic<T>& counter, T amount = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+} // namespace
+
+bool LogRecordPool::grow(long below)
+{
+    if (chunks == 0) { return false; }
+
+    // Obtaining and linking a chunk is slow, so it is done without holding the
+    // stack lock. Other threads can keep allocating and freeing meanwhile.
+    std::unique_lock<std::mutex> grow_guard(grow_lock);
+    if (free_count.load(std::memory_order_relaxed) >= below) {
+        return true; // Someone else refilled the pool while we waited
+    }
+    auto allocation = pool->allocate(chunks, message_size);
+    if (nullptr == allocation.records) { // Memory exhausted
+        return false;
     }
     LogRecord* here = nullptr;
-    LogRecord* next = head;
+    LogRecord* next = nullptr;
     // Link nodes and insert message memory
     for (long i = chunks - 1; i >= 0; i--) {
-        here = &allocation.first[i];
-        here->m_message = allocation.second + i * message_size;
+        here = &allocation.records[i];
+        here->m_message = allocation.messages + i * message_size;
         here->m_message_max_size = message_size;
+        here->m_pool = this;
         here->m_next = next;
         next = here;
     }
+    LogRecord* last = &allocation.records[chunks - 1];
+
+    std::unique_lock<std::mutex> guard(lock);
+    last->m_next = head;
     head = here;
+    bump(free_count, chunks);
+    bump(capacity, chunks);
+    bump(footprint, static_cast<long>(allocation.bytes));
+    wake_waiters(guard, chunks);
+    return true;
+}
+
+bool LogRecordPool::replenish()
+{
+    long watermark = low_watermark.load(std::memory_order_relaxed);
+    if (policy != ALLOCATE || free_count.load(std::memory_order_relaxed) >= watermark || over_soft_cap()) {
+        return false;
+    }
+    if (!grow(watermark)) {
+        return false;
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    bump(replenish_count);
+    return true;
 }
 
 LogRecordPool::LogRecordPool(LogRecordPoolPolicy new_policy, long new_alloc_size, long new_message_size,
-                             long new_max_blocking_time_ms)
+                             long new_max_blocking_time_ms, int memory_flags)
     : policy(new_policy),
       max_blocking_time_ms(new_max_blocking_time_ms),
       message_size(new_message_size),
       chunks(std::max<long>(16L, new_alloc_size / (sizeof(LogRecord) + message_size))),
       head(nullptr),
-      pool(new PoolMemory)
+      pool(new PoolMemory(memory_flags)),
+      free_count(0),
+      capacity(0),
+      high_water(0),
+      allocation_count(0),
+      discard_count(0),
+      block_count(0),
+      blocked_ns(0),
+      max_blocked_ns(0),
+      jumbo_count(0),
+      replenish_count(0),
+      refusal_count(0),
+      spill_count(0),
+      footprint(0),
+      reclaimed_bytes(0),
+      low_watermark(0),
+      trim_interval_ms(0),
+      last_trim_ms(0),
+      soft_cap_bytes(0),
+      soft_cap_severity(FATL),
+      soft_cap_policy(DISCARD),
+      reserve_records(0),
+      reserve_severity(FATL),
+      waiters(0),
+      fair_blocking(false),
+      serial(s_next_pool_serial.fetch_add(1, std::memory_order_relaxed)),
+      thread_blocking_count(0)
 {
-    acquire_blank_records();
+    grow(1);
 }
 
 LogRecordPool::~LogRecordPool() { delete pool; }
 
-LogRecord* LogRecordPool::allocate()
-{
-    NodePtr allocated = nullptr;
-    switch (policy) {
-    case ALLOCATE: {
-        std::unique_lock<std::mutex> guard(lock);
-        if (nullptr == head) {
-            acquire_blank_records();
-            assert(head);
-        }
-        allocated = head;
-        head = head->m_next;
-        break;
-    }
-    case BLOCK: {
-        std::chrono::milliseconds wait{max_blocking_time_ms};
-        std::unique_lock<std::mutex> guard(lock);
-        if (nonempty.wait_for(guard, wait, [this]() -> bool { return head != nullptr; })) {
-            allocated = head;
-            head = head->m_next;
-        }
-        break;
-    }
-    case DISCARD:
-    default: {
-        std::unique_lock<std::mutex> guard(lock);
-        allocated = head;
+LogRecord* LogRecordPool::allocate(int severity)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    if (!available(severity)) {
+        LogRecordPoolPolicy empty_policy = policy;
+        if (policy == ALLOCATE && severity > soft_cap_severity && over_soft_cap()) {
+            empty_policy = soft_cap_policy;
+        }
+        switch (empty_policy) {
+        case ALLOCATE:
+            // Other threads may take the new chunk before the lock is retaken,
+            // so keep growing until a record is left for us or memory runs out
+            while (!available(severity)) {
+                guard.unlock();
+                bool grown = grow(severity > reserve_severity ? reserve_records + 1 : 1);
+                guard.lock();
+                if (!grown) {
+                    break;
+                }
+            }
+            break;
+        case BLOCK:
+            if (fair_blocking) {
+                // Records are handed over directly, so there is nothing to pop
+                LogRecord* granted = wait_in_line(guard, severity);
+                if (granted) {
+                    return granted;
+                }
+            } else {
+                wait_for_record(guard, severity);
+            }
+            break;
+        case DISCARD:
+        case SPILL:
+        default:
+            break;
+        }
+    }
+
+    if (!available(severity)) {
+        if (policy == SPILL) {
+            bump(spill_count); // The channel spills the record instead
+        } else {
+            bump(discard_count);
+        }
         if (head) {
-            head = head->m_next;
+            bump(refusal_count);
         }
-        break;
+        return nullptr;
+    }
+    return pop();
+}
+
+LogRecord* LogRecordPool::try_allocate(int severity)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    if (!available(severity)) {
+        return nullptr;
     }
+    return pop();
+}
+
+LogRecord* LogRecordPool::pop()
+{
+    NodePtr allocated = head;
+    head = head->m_next;
+    bump(free_count, -1L);
+    bump(allocation_count);
+    long in_use = capacity.load(std::memory_order_relaxed) - free_count.load(std::memory_order_relaxed);
+    if (in_use > high_water.load(std::memory_order_relaxed)) {
+        high_water.store(in_use, std::memory_order_relaxed);
     }
     return allocated;
 }
 
-void LogRecordPool::free(LogRecord* node)
+long LogRecordPool::trim()
+{
+    std::unique_lock<std::mutex> grow_guard(grow_lock);
+    auto const& allocations = pool->list();
+    if (allocations.size() < 2) {
+        return 0;
+    }
+
+    // The first allocation is never trimmed. Sort the rest by address so that
+    // free records can be attributed to their allocation.
+    std::vector<std::pair<LogRecord*, std::size_t>> by_address;
+    for (std::size_t i = 1; i < allocations.size(); i++) {
+        by_address.emplace_back(allocations[i].records, i);
+    }
+    std::sort(by_address.begin(), by_address.end());
+    auto owner = [&](LogRecord* record) -> std::size_t {
+        auto it = std::upper_bound(by_address.begin(), by_address.end(),
+                                   std::make_pair(record, allocations.size()));
+        if (it == by_address.begin()) {
+            return 0;
+        }
+        --it;
+        return (record < it->first + chunks) ? it->second : 0;
+    };
+
+    std::unique_lock<std::mutex> guard(lock);
+    std::vector<long> free_records(allocations.size(), 0);
+    for (LogRecord* cursor = head; cursor != nullptr; cursor = cursor->m_next) {
+        free_records[owner(cursor)]++;
+    }
+    // Release whole chunks, but stay at or above the low watermark so that
+    // replenish() doesn't immediately undo the work.
+    long keep = low_watermark.load(std::memory_order_relaxed);
+    long remaining = free_count.load(std::memory_order_relaxed);
+    std::vector<bool> doomed(allocations.size(), false);
+    std::vector<std::size_t> released;
+    long bytes = 0;
+    for (std::size_t i = 1; i < allocations.size(); i++) {
+        if (free_records[i] == chunks && remaining - chunks >= keep) {
+            doomed[i] = true;
+            released.push_back(i);
+            remaining -= chunks;
+            bytes += static_cast<long>(allocations[i].bytes);
+        }
+    }
+    if (released.empty()) {
+        return 0;
+    }
+    // Unlink the doomed records, preserving the order of the rest
+    LogRecord** link = &head;
+    while (*link) {
+        if (doomed[owner(*link)]) {
+            *link = (*link)->m_next;
+        } else {
+            link = &(*link)->m_next;
+        }
+    }
+    long dropped = free_count.load(std::memory_order_relaxed) - remaining;
+    bump(free_count, -dropped);
+    bump(capacity, -dropped);
+    bump(footprint, -bytes);
+    bump(reclaimed_bytes, static_cast<uint64_t>(bytes));
+    guard.unlock();
+
+    pool->release(released);
+    return bytes;
+}
+
+void LogRecordPool::set_trim_interval(long interval_ms)
 {
-    if (node) {
-        if (node->m_more) {
-            free(node->m_more);
+    trim_interval_ms.store(interval_ms, std::memory_order_relaxed);
+}
+
+void LogRecordPool::maintain()
+{
+    replenish();
+    forget_exited_threads();
+    long interval_ms = trim_interval_ms.load(std::memory_order_relaxed);
+    if (interval_ms <= 0 || policy != ALLOCATE) {
+        return;
+    }
+    long long now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
+                        .count();
+    long long previous = last_trim_ms.load(std::memory_order_relaxed);
+    // Pools may be shared by several workers. Only one of them trims.
+    if (now - previous >= interval_ms &&
+        last_trim_ms.compare_exchange_strong(previous, now, std::memory_order_relaxed)) {
+        trim();
+    }
+}
+
+void LogRecordPool::set_soft_cap(long bytes, int severity_threshold, LogRecordPoolPolicy over_cap_policy)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    soft_cap_bytes.store(bytes, std::memory_order_relaxed);
+    soft_cap_severity = severity_threshold;
+    soft_cap_policy = (over_cap_policy == BLOCK ? BLOCK : DISCARD);
+}
+
+bool LogRecordPool::over_soft_cap() const
+{
+    long cap = soft_cap_bytes.load(std::memory_order_relaxed);
+    return cap > 0 && footprint.load(std::memory_order_relaxed) >= cap;
+}
+
+void LogRecordPool::set_reserve(long records, int severity_threshold)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    reserve_records = records;
+    reserve_severity = severity_threshold;
+}
+
+bool LogRecordPool::available(int severity) const
+{
+    return head != nullptr &&
+           (severity <= reserve_severity || free_count.load(std::memory_order_relaxed) > reserve_records);
+}
+
+bool LogRecordPool::wait_for_record(std::unique_lock<std::mutex>& guard, int severity)
+{
+    std::chrono::milliseconds wait{max_blocking_time_ms};
+    auto start = std::chrono::steady_clock::now();
+    waiters++;
+    bool ready = nonempty.wait_for(guard, wait, [this, severity]() -> bool { return available(severity); });
+    waiters--;
+    record_block(std::chrono::steady_clock::now() - start);
+    return ready;
+}
+
+/**
+ * A thread waiting in a fair pool. The waiter lives on the waiting thread's
+ * stack. Records are handed to it directly by wake_waiters().
+ */
+struct LogRecordPool::Waiter {
+    std::condition_variable ready;
+    int severity;
+    LogRecord* record;
+};
+
+LogRecord* LogRecordPool::wait_in_line(std::unique_lock<std::mutex>& guard, int severity)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::milliseconds{max_blocking_time_ms};
+    Waiter me;
+    me.severity = severity;
+    me.record = nullptr;
+    line.push_back(&me);
+    while (nullptr == me.record) {
+        if (me.ready.wait_until(guard, deadline) == std::cv_status::timeout) {
+            break;
         }
-        node->reset();
-        std::unique_lock<std::mutex> guard(lock);
-        node->m_next = head;
-        head = node;
-        guard.unlock();
-        if (policy == BLOCK) {
+    }
+    if (nullptr == me.record) {
+        line.erase(std::find(line.begin(), line.end(), &me));
+    }
+    record_block(std::chrono::steady_clock::now() - start);
+    return me.record;
+}
+
+void LogRecordPool::wake_waiters(std::unique_lock<std::mutex>& guard, long count)
+{
+    // Fair waiters are served in arrival order, skipping any that the
+    // reserve keeps from taking a record.
+    for (auto it = line.begin(); it != line.end() && head != nullptr;) {
+        Waiter* waiter = *it;
+        if (available(waiter->severity)) {
+            waiter->record = pop();
+            waiter->ready.notify_one();
+            it = line.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    bool notify = (waiters > 0 && head != nullptr);
+    bool reserving = (reserve_records > 0);
+    guard.unlock();
+    if (notify) {
+        // With a reserve, a waiter may not be eligible for the freed record,
+        // so everyone has to check.
+        if (count == 1 && !reserving) {
             nonempty.notify_one();
+        } else {
+            nonempty.notify_all();
+        }
+    }
+}
+
+void LogRecordPool::record_block(std::chrono::steady_clock::duration blocked)
+{
+    uint64_t ns = static_cast<uint64_t>(std::chrono::nanoseconds(blocked).count());
+    bump(block_count);
+    bump(blocked_ns, ns);
+    if (ns > max_blocked_ns.load(std::memory_order_relaxed)) {
+        max_blocked_ns.store(ns, std::memory_order_relaxed);
+    }
+    // Only a thread's first wait on this pool allocates
+    PoolThreadBlocking* slot = nullptr;
+    for (auto const& entry : t_blocking.slots) {
+        if (entry.first == serial) {
+            slot = entry.second.get();
+            break;
         }
     }
+    if (nullptr == slot) {
+        // Drop entries for pools that are gone
+        auto& slots = t_blocking.slots;
+        slots.erase(std::remove_if(slots.begin(), slots.end(),
+                                   [](std::pair<uint64_t, std::shared_ptr<PoolThreadBlocking>> const& entry) {
+                                       return entry.second.use_count() == 1;
+                                   }),
+                    slots.end());
+        slots.emplace_back(serial, std::make_shared<PoolThreadBlocking>());
+        thread_blocking.push_back(slots.back().second);
+        thread_blocking_count.store(thread_blocking.size(), std::memory_order_relaxed);
+        slot = slots.back().second.get();
+    }
+    LogRecordPoolThreadStats& mine = slot->stats;
+    mine.blocks++;
+    mine.blocked_ns += ns;
+    mine.max_blocked_ns = std::max(mine.max_blocked_ns, ns);
+}
+
+void LogRecordPool::forget_exited_threads()
+{
+    if (thread_blocking_count.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    thread_blocking.erase(std::remove_if(thread_blocking.begin(), thread_blocking.end(),
+                                         [](std::shared_ptr<PoolThreadBlocking> const& entry) {
+                                             return entry->exited.load(std::memory_order_relaxed);
+                                         }),
+                          thread_blocking.end());
+    thread_blocking_count.store(thread_blocking.size(), std::memory_order_relaxed);
+}
+
+void LogRecordPool::set_fair_blocking(bool fair)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    fair_blocking = fair;
+}
+
+std::vector<LogRecordPoolThreadStats> LogRecordPool::blocking_stats() const
+{
+    std::vector<LogRecordPoolThreadStats> result;
+    std::unique_lock<std::mutex> guard(lock);
+    for (auto const& entry : thread_blocking) {
+        result.push_back(entry->stats);
+    }
+    return result;
 }
 
-long LogRecordPool::count() const
+void LogRecordPool::release(LogRecord* first, LogRecord* last, long count, long jumbo)
 {
     std::unique_lock<std::mutex> guard(lock);
-    long c = 0;
-    NodePtr cursor = head;
-    while (cursor) {
-        c++;
-        cursor = cursor->m_next;
+    last->m_next = head;
+    head = first;
+    bump(free_count, count);
+    bump(jumbo_count, static_cast<uint64_t>(jumbo));
+    wake_waiters(guard, count);
+}
+
+void LogRecordPool::free(LogRecord* node)
+{
+    // Gather this pool's nodes into one list so the lock is taken once. Jumbo
+    // parts may have come from a different pool, so those go back to their
+    // owner.
+    LogRecord* first = nullptr;
+    LogRecord* last = nullptr;
+    long count = 0;
+    long jumbo = 0;
+    for (LogRecord* cursor = node; cursor != nullptr;) {
+        LogRecord* more = cursor->m_more;
+        cursor->reset();
+        if (cursor->m_pool != this) {
+            cursor->m_pool->release(cursor, cursor, 1, cursor != node);
+        } else {
+            cursor->m_next = first;
+            first = cursor;
+            if (nullptr == last) {
+                last = cursor;
+            }
+            count++;
+            jumbo += (cursor != node);
+        }
+        cursor = more;
     }
-    return c;
+    if (count) {
+        release(first, last, count, jumbo);
+    }
+}
+
+LogRecordPoolStats LogRecordPool::stats() const
+{
+    LogRecordPoolStats snapshot;
+    snapshot.capacity = capacity.load(std::memory_order_relaxed);
+    snapshot.free = free_count.load(std::memory_order_relaxed);
+    snapshot.in_use = snapshot.capacity - snapshot.free;
+    snapshot.high_water = high_water.load(std::memory_order_relaxed);
+    snapshot.allocations = allocation_count.load(std::memory_order_relaxed);
+    snapshot.discards = discard_count.load(std::memory_order_relaxed);
+    snapshot.blocks = block_count.load(std::memory_order_relaxed);
+    snapshot.blocked_ns = blocked_ns.load(std::memory_order_relaxed);
+    snapshot.max_blocked_ns = max_blocked_ns.load(std::memory_order_relaxed);
+    snapshot.jumbo_nodes = jumbo_count.load(std::memory_order_relaxed);
+    snapshot.replenishments = replenish_count.load(std::memory_order_relaxed);
+    snapshot.refusals = refusal_count.load(std::memory_order_relaxed);
+    snapshot.spills = spill_count.load(std::memory_order_relaxed);
+    snapshot.footprint_bytes = footprint.load(std::memory_order_relaxed);
+    snapshot.reclaimed_bytes = reclaimed_bytes.load(std::memory_order_relaxed);
+    return snapshot;
 }
 } // namespace slog
@@ -1,6 +1,14 @@
 #pragma once
+#include <atomic>
 #include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <mutex>
+#include <string>
+#include <memory>
+#include <thread>
+#include <vector>
 #include "SlogConfig.hpp"
 #include "LogRecord.hpp"
 
@@ -10,8 +18,58 @@ namespace slog
 using NodePtr = LogRecord*;
 
 class PoolMemory;
+struct PoolThreadBlocking;
 
-enum LogRecordPoolPolicy { ALLOCATE, BLOCK, DISCARD };
+/**
+ * What to do when the pool is exhausted. SPILL writes records to a per-thread
+ * overflow file that the worker replays into the sink in order.
+ */
+enum LogRecordPoolPolicy { ALLOCATE, BLOCK, DISCARD, SPILL };
+
+/**
+ * Flags controlling where pool memory comes from. These may be or-ed together.
+ */
+enum LogRecordPoolMemory {
+    HEAP_MEMORY = 0,   // Plain operator new (the default)
+    MAPPED_MEMORY = 1, // Anonymous mmap() regions
+    HUGE_PAGES = 2,    // Back the pool with huge pages (implies MAPPED_MEMORY)
+    PREFAULT = 4,      // Fault every page in when the memory is acquired
+    LOCK_MEMORY = 8    // mlock() the memory so it is never paged out
+};
+
+/**
+ * @brief A snapshot of pool usage counters
+ *
+ * The counters are read without taking the pool lock, so the fields may be
+ * very slightly out of step with each other while the pool is in use.
+ */
+struct LogRecordPoolStats {
+    long free;              //!< Records available in the pool
+    long in_use;            //!< Records handed out and not yet returned
+    long high_water;        //!< Largest value in_use has reached
+    long capacity;          //!< Total records owned by the pool
+    uint64_t allocations;   //!< Successful allocate() calls
+    uint64_t discards;      //!< allocate() calls that returned nullptr
+    uint64_t blocks;        //!< allocate() calls that had to wait for a record (BLOCK policy)
+    uint64_t blocked_ns;    //!< Total nanoseconds spent waiting in allocate()
+    uint64_t max_blocked_ns; //!< Longest single wait in allocate()
+    uint64_t jumbo_nodes;   //!< Records that were used as jumbo record continuations
+    uint64_t replenishments; //!< Chunks added in the background by replenish()
+    uint64_t refusals;      //!< Discards of less important records made to protect the reserve
+    uint64_t spills;        //!< allocate() calls that found a SPILL pool empty
+    long footprint_bytes;    //!< Memory currently held by the pool
+    uint64_t reclaimed_bytes; //!< Memory returned to the OS by trim()
+};
+
+/**
+ * @brief Blocking counters for one thread that has waited on a pool
+ */
+struct LogRecordPoolThreadStats {
+    std::thread::id thread;  //!< The waiting thread
+    uint64_t blocks;         //!< Number of waits
+    uint64_t blocked_ns;     //!< Total nanoseconds spent waiting
+    uint64_t max_blocked_ns; //!< Longest single wait
+};
 
 /**
  * @brief A memory pool for unused log records
@@ -26,7 +84,10 @@ enum LogRecordPoolPolicy { ALLOCATE, BLOCK, DISCARD };
  * messages will require multiple nodes)
  * @param max_blocking_time_ms -- Max milliseconds to block in BLOCK policy
  * mode while waiting for blank records to be returned to the pool. This has no
- * effect in ALLOCATE or DISCARD mode.
+ * effect in ALLOCATE, DISCARD, or SPILL mode.
+ * @param memory_flags -- Or-ed LogRecordPoolMemory flags. Using
+ * PREFAULT | LOCK_MEMORY with a BLOCK or DISCARD pool ensures logging never
+ * takes a page fault on the business thread.
  */
 class LogRecordPool
 {
@@ -34,7 +95,8 @@ class LogRecordPool
     LogRecordPool(LogRecordPoolPolicy policy,
                   long pool_alloc_size = DEFAULT_POOL_RECORD_COUNT *
                                          (DEFAULT_RECORD_SIZE + sizeof(LogRecord)),
-                  long message_size = DEFAULT_RECORD_SIZE, long max_blocking_time_ms = 50);
+                  long message_size = DEFAULT_RECORD_SIZE, long max_blocking_time_ms = 50,
+                  int memory_flags = HEAP_MEMORY);
 
     ~LogRecordPool();
     LogRecordPool(LogRecordPool const&) = delete;
@@ -43,24 +105,164 @@ class LogRecordPool
     LogRecordPool& operator=(LogRecordPool&&) = delete;
 
     /**
-     * Pop a record from the stack. If the stack is currently empty,
-     * the LogRecordPoolPolicy determines what happens.
+     * Pop a record from the stack. If none is available, the
+     * LogRecordPoolPolicy determines what happens. Under every policy, the
+     * severity of the record decides whether it may take one of the reserved
+     * records (see set_reserve()). For an ALLOCATE pool over its soft cap, it
+     * also decides whether the soft cap policy applies instead.
      */
-    LogRecord* allocate();
+    LogRecord* allocate(int severity = FATL);
 
     /**
-     * Return a record to the pool as free.
+     * Pop a record only if one is available right now. This never blocks or
+     * grows the pool, regardless of policy.
+     */
+    LogRecord* try_allocate(int severity = FATL);
+
+    /**
+     * Return a record to the pool as free. Records (and jumbo record parts)
+     * that were allocated by another pool are returned to that pool instead.
      */
     void free(LogRecord* record);
 
-    // Count items in the pool. Not thread-safe
-    long count() const;
+    /// Count free items in the pool. This is O(1) and does not lock.
+    long count() const { return free_count.load(std::memory_order_relaxed); }
+
+    /// Obtain the usage counters. This is O(1) and does not lock.
+    LogRecordPoolStats stats() const;
+
+    /**
+     * @brief Set the low watermark for background replenishment.
+     *
+     * When an ALLOCATE pool has fewer than this many free records, the
+     * worker thread allocates another chunk so that producers rarely find the
+     * pool empty and pay for the allocation themselves. Zero (the default)
+     * disables replenishment. This has no effect for BLOCK or DISCARD pools.
+     */
+    void set_low_watermark(long records) { low_watermark.store(records, std::memory_order_relaxed); }
+
+    /// Get the low watermark
+    long get_low_watermark() const { return low_watermark.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Top up the pool if it is below the low watermark.
+     * This is called periodically by the worker thread. Thread safe.
+     * @return true if a chunk was added
+     */
+    bool replenish();
+
+    /**
+     * @brief Return fully free chunks to the OS.
+     *
+     * The first chunk is always kept, as are enough chunks to stay at or above
+     * the low watermark. Thread safe, but this walks the free list with the
+     * pool locked, so call it when logging is quiet.
+     * @return The number of bytes released
+     */
+    long trim();
+
+    /**
+     * @brief Have the worker thread call trim() at most once per interval.
+     * Zero (the default) disables automatic trimming. Only ALLOCATE pools are
+     * trimmed automatically.
+     */
+    void set_trim_interval(long interval_ms);
+
+    /**
+     * @brief Set a soft limit on the memory an ALLOCATE pool may hold.
+     *
+     * Once the footprint reaches soft_cap_bytes, an empty pool only grows for
+     * records at least as important as severity_threshold. Less important
+     * records are handled by over_cap_policy (BLOCK or DISCARD) instead. A
+     * zero cap (the default) disables the limit.
+     */
+    void set_soft_cap(long soft_cap_bytes, int severity_threshold = WARN,
+                      LogRecordPoolPolicy over_cap_policy = DISCARD);
+
+    /**
+     * @brief Hold back records for important messages.
+     *
+     * Once only `records` free records remain, allocations for severities
+     * numerically above severity_threshold are treated as if the pool were
+     * empty: a BLOCK pool waits for more records, a DISCARD pool drops the
+     * message, and an ALLOCATE pool grows. More important severities may use
+     * the reserved records. A zero reserve (the default) disables this.
+     */
+    void set_reserve(long records, int severity_threshold = WARN);
+
+    /**
+     * @brief Serve blocked threads in arrival order.
+     *
+     * Normally, a freed record goes to whichever waiting thread the OS wakes
+     * first, so under sustained overload some threads can wait much longer than
+     * others. In fair mode, each waiter queues and freed records are handed to
+     * the oldest waiter directly. This costs a little more per blocked
+     * allocation, but bounds each thread's wait by its place in line.
+     */
+    void set_fair_blocking(bool fair = true);
+
+    /// Obtain blocking counters for each thread that has waited on this pool.
+    /// Threads that have exited are dropped by the next maintain(). This locks
+    /// the pool.
+    std::vector<LogRecordPoolThreadStats> blocking_stats() const;
+
+    /// The policy used when the pool is exhausted
+    LogRecordPoolPolicy get_policy() const { return policy; }
+
+    /// The message capacity of each record
+    long get_message_size() const { return message_size; }
+
+    /**
+     * @brief Set the directory for SPILL overflow files. The files are
+     * anonymous and vanish when the channel is destroyed. An empty directory
+     * (the default) uses $TMPDIR or /tmp. Set this before starting the logger.
+     */
+    void set_spill_directory(std::string const& directory) { spill_directory = directory; }
+
+    /// Get the directory for SPILL overflow files
+    std::string const& get_spill_directory() const { return spill_directory; }
+
+    /// Periodic housekeeping: replenish(), forget the blocking counters of
+    /// exited threads and, if due, trim(). Called by the worker thread.
+    void maintain();
 
   private:
-    void acquire_blank_records();
+    /// Add a chunk of records unless the free count is already at least below.
+    /// Returns false if memory is exhausted.
+    bool grow(long below);
+
+    /// Push the list [first, last] of reset records onto the stack
+    void release(LogRecord* first, LogRecord* last, long count, long jumbo_count);
+
+    /// Check if a record of this severity can be popped. Lock must be held.
+    bool available(int severity) const;
+
+    /// Wait (with the lock held by guard) for a record of this severity to
+    /// become available. Returns false on timeout.
+    bool wait_for_record(std::unique_lock<std::mutex>& guard, int severity);
+
+    struct Waiter;
+
+    /// Queue for a record in fair mode. Returns nullptr on timeout.
+    LogRecord* wait_in_line(std::unique_lock<std::mutex>& guard, int severity);
+
+    /// Hand records to fair waiters and signal other waiters. Unlocks guard.
+    void wake_waiters(std::unique_lock<std::mutex>& guard, long count);
+
+    /// Pop the head of the stack. Lock must be held.
+    LogRecord* pop();
+
+    /// Account for a wait in allocate(). Lock must be held.
+    void record_block(std::chrono::steady_clock::duration blocked);
+
+    /// Drop the blocking counters of threads that have exited
+    void forget_exited_threads();
+
+    bool over_soft_cap() const;
 
     mutable std::mutex lock;
     std::condition_variable nonempty;
+    std::mutex grow_lock; // Serializes chunk allocation
 
     LogRecordPoolPolicy policy;
     long max_blocking_time_ms;
@@ -69,5 +271,38 @@ class LogRecordPool
 
     NodePtr head;   // head of the stack
     PoolMemory* pool; // Start of heap allocated region
+
+    // Counters. These are only written with the lock held, but may be read
+    // at any time.
+    std::atomic<long> free_count;
+    std::atomic<long> capacity;
+    std::atomic<long> high_water;
+    std::atomic<uint64_t> allocation_count;
+    std::atomic<uint64_t> discard_count;
+    std::atomic<uint64_t> block_count;
+    std::atomic<uint64_t> blocked_ns;
+    std::atomic<uint64_t> max_blocked_ns;
+    std::atomic<uint64_t> jumbo_count;
+    std::atomic<uint64_t> replenish_count;
+    std::atomic<uint64_t> refusal_count;
+    std::atomic<uint64_t> spill_count;
+    std::atomic<long> footprint;
+    std::atomic<uint64_t> reclaimed_bytes;
+
+    std::atomic<long> low_watermark;
+    std::atomic<long> trim_interval_ms;
+    std::atomic<long long> last_trim_ms;
+    std::atomic<long> soft_cap_bytes;
+    int soft_cap_severity;
+    LogRecordPoolPolicy soft_cap_policy;
+    long reserve_records;
+    int reserve_severity;
+    long waiters; // Threads in wait_for_record()
+    bool fair_blocking;
+    std::deque<Waiter*> line; // Fair waiters in arrival order
+    uint64_t serial;          // Keys each thread's blocking counters for this pool
+    std::vector<std::shared_ptr<PoolThreadBlocking>> thread_blocking; // Shared with t_blocking
+    std::atomic<std::size_t> thread_blocking_count;
+    std::string spill_directory;
 };
 } // namespace slog
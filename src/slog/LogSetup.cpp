@@ -1,10 +1,12 @@
 
 #include "LogSetup.hpp"
 #include <cassert>
+#include <limits>
 #include <vector>
 
 #include "ConsoleSink.hpp"
 #include "LoggerSingleton.hpp"
+#include "Signal.hpp"
 
 namespace slog
 {
@@ -17,6 +19,34 @@ void start_logger(LogConfig const& config)
     start_logger(vconfig);
 }
 
+LogRecordPoolStats pool_stats(int channel) { return Logger::get_channel(channel).pool_stats(); }
+
+void set_drain_deadline(long deadline_ms, int fallback_fd)
+{
+    set_drain_deadline_ns(deadline_ms * 1000000LL, fallback_fd);
+}
+
+int add_channel(LogConfig const& config) { return Logger::add_channel(config); }
+
+bool remove_channel(int channel) { return Logger::remove_channel(channel); }
+
+bool set_sink(int channel, std::shared_ptr<LogSink> sink) { return Logger::set_sink(channel, std::move(sink)); }
+
+void set_threshold(int channel, char const* tag, int severity)
+{
+    Logger::get_channel(channel).set_threshold(tag, severity);
+    Logger::update_verbosity_gate();
+}
+
+void set_default_threshold(int channel, int severity) { set_threshold(channel, "", severity); }
+
+int event_fd() { return Logger::event_fd(); }
+
+std::size_t drain(std::size_t max_records, std::chrono::steady_clock::time_point deadline)
+{
+    return Logger::drain(max_records, deadline);
+}
+
 void start_logger(std::vector<LogConfig> config)
 {
     if (config.empty()) {
@@ -28,13 +58,50 @@ void start_logger(std::vector<LogConfig> config)
 
 LogConfig::LogConfig()
     : workerThreadId(0),
+      workerPoolThreads(0),
+      externalDrain(false),
+      workerNumaNode(-1),
+      workerScheduling(NORMAL_SCHEDULING),
+      workerNice(0),
+      numaPools(false),
+      laneScheduling(SINGLE_LANE),
+      preserveOrder(false),
+      batchRecords(0),
+      batchDelayMs(10),
+      batchImmediateSeverity(WARN),
+      syncSeverity(std::numeric_limits<int>::min()),
+      formatThreads(1),
+      coalesceDuplicates(false),
+      coalesceDelayMs(1000),
+      shedHighWater(0),
+      shedLowWater(0),
+      shedIntervalMs(0),
       pool(nullptr),
       sink(std::make_shared<ConsoleSink>())
 {
 }
 
 LogConfig::LogConfig(int default_threshold, std::shared_ptr<LogSink> new_sink)
-    : sink(new_sink)
+    : workerThreadId(0),
+      workerPoolThreads(0),
+      externalDrain(false),
+      workerNumaNode(-1),
+      workerScheduling(NORMAL_SCHEDULING),
+      workerNice(0),
+      numaPools(false),
+      laneScheduling(SINGLE_LANE),
+      preserveOrder(false),
+      batchRecords(0),
+      batchDelayMs(10),
+      batchImmediateSeverity(WARN),
+      syncSeverity(std::numeric_limits<int>::min()),
+      formatThreads(1),
+      coalesceDuplicates(false),
+      coalesceDelayMs(1000),
+      shedHighWater(0),
+      shedLowWater(0),
+      shedIntervalMs(0),
+      sink(new_sink)
 {
     threshold.set_default(default_threshold);
 }
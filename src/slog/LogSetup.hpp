@@ -1,5 +1,8 @@
 #pragma once
+#include <chrono>
+#include <limits>
 #include <memory>
+#include <string>
 #include <vector>
 #if SLOG_STREAM
 #include <ostream>
@@ -41,6 +44,24 @@ namespace slog
  */
 class LogConfig;
 
+/**
+ * How a worker chooses between its queue lanes. See LogConfig::set_priority_lanes().
+ */
+enum LaneScheduling {
+    SINGLE_LANE,      // One FIFO queue (the default)
+    STRICT_PRIORITY,  // Always drain the most important nonempty lane first
+    WEIGHTED_PRIORITY // Take up to weights[i] records from lane i per round
+};
+
+/**
+ * CPU scheduling class of a worker thread. See LogConfig::set_worker_scheduling().
+ */
+enum WorkerScheduling : int {
+    NORMAL_SCHEDULING, // The default (SCHED_OTHER)
+    BATCH_SCHEDULING,  // SCHED_BATCH: never preempts other threads when it wakes
+    IDLE_SCHEDULING    // SCHED_IDLE: only runs on CPUs with nothing else to do
+};
+
 /**
  * @brief Start a logger on the default channel with the given config.
  * @param config The configuration for the only channel
@@ -55,6 +76,91 @@ void start_logger(LogConfig const& config);
  */
 void start_logger(std::vector<LogConfig> configs);
 
+/**
+ * @brief Obtain the record pool usage counters for a channel.
+ *
+ * This is lock-free and cheap enough to poll from a metrics thread. If the
+ * channel uses per-NUMA-node pools, the counters are summed over the nodes.
+ */
+LogRecordPoolStats pool_stats(int channel = DEFAULT_CHANNEL);
+
+/**
+ * @brief Bound the time spent writing queued records at stop_logger(), exit,
+ * or a handled signal.
+ *
+ * Workers drain in parallel. Records still queued deadline_ms after the drain
+ * starts are written raw (severity and message only) to fallback_fd instead
+ * of the sink. A signal handler waits at most a second past the deadline for
+ * the workers before re-raising the signal. Zero or negative deadlines (the
+ * default) wait for every record to reach its sink.
+ */
+void set_drain_deadline(long deadline_ms, int fallback_fd = 2);
+
+/**
+ * @brief Add a channel to the running logger, without restarting it. Returns
+ * the new channel id, or -1 if the logger is not running.
+ *
+ * The channel gets a worker thread of its own: set_worker_thread_id(),
+ * set_worker_pool() and set_external_drain() are ignored. Unless the config
+ * sets a pool, the channel shares the default pool of the running channels,
+ * so only the thread (and its queue) is new.
+ */
+int add_channel(LogConfig const& config);
+
+/**
+ * @brief Remove a channel from the running logger. Its future records go to
+ * the default channel, as for unknown channels. Records already queued are
+ * written, then its sink is finalized on the worker thread. If the channel
+ * had its worker thread to itself (as added channels do), this waits for
+ * that and stops the thread. Records that race the removal are dropped and
+ * counted as drops. The default channel can't be removed. Returns false if
+ * the channel is not live.
+ */
+bool remove_channel(int channel);
+
+/**
+ * @brief Give a running channel a new sink. Records queued before the call
+ * go to the old sink, which is then flushed and finalized on the worker
+ * thread; later records go to the new one. Returns false if the channel is
+ * not live.
+ */
+bool set_sink(int channel, std::shared_ptr<LogSink> sink);
+
+/**
+ * @brief Change the threshold for a tag on a running channel, without
+ * restarting the logger. Threads already logging see the change promptly and
+ * never block on it. An empty tag changes the default threshold.
+ */
+void set_threshold(int channel, char const* tag, int severity);
+
+/**
+ * @brief Change the threshold for untagged and unknown tags on a running
+ * channel. See set_threshold().
+ */
+void set_default_threshold(int channel, int severity);
+
+/**
+ * @brief Get a descriptor that becomes readable when channels set up with
+ * LogConfig::set_external_drain() have records to write, for use with epoll,
+ * poll or select. Call drain() when it is readable. Returns -1 if no channel
+ * is drained externally. The descriptor is closed by stop_logger().
+ */
+int event_fd();
+
+/**
+ * @brief Write records from channels set up with
+ * LogConfig::set_external_drain(), through the same path a worker thread uses.
+ *
+ * Stops after max_records records, once the deadline passes, or when nothing
+ * is queued, and returns the number of records taken. If work remains,
+ * event_fd() stays readable. Call this at least every 50 ms or so (say, as
+ * the epoll timeout) so that staged records and pool upkeep are not delayed.
+ * Only one thread drains at a time; other callers return 0 at once. After a
+ * handled signal, this writes every queued record and returns 0.
+ */
+std::size_t drain(std::size_t max_records = std::numeric_limits<std::size_t>::max(),
+                  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+
 #if SLOG_STREAM_LOG
 /**
  * @brief Set the log stream locale for all channels
@@ -67,7 +173,7 @@ void set_locale_to_global();
  * Configuration class for a logger channel. Set your logging threshold,
  * tags, log sink here, and record pool here. By default, the sink is a
  * NullSink that discards all messages and the pool is a shared global
- * pool that allocates when empty.
+ * pool that the worker grows whenever it runs low on free records.
  */
 class LogConfig
 {
@@ -109,6 +215,31 @@ class LogConfig
      */
     void set_pool(std::shared_ptr<LogRecordPool> new_pool) { pool = new_pool; }
 
+    /**
+     * @brief Use one record pool per NUMA node
+     *
+     * Producers allocate records from the pool on their own node, avoiding
+     * remote memory traffic on multi-socket machines. Unless set_node_pools()
+     * is used, each node gets a default allocating pool whose memory is
+     * placed on that node. Nodes are discovered via sysfs. On machines with a
+     * single node this has no effect.
+     */
+    void set_numa_pools(bool doit = true) { numaPools = doit; }
+
+    /**
+     * @brief Supply the per-node pools for set_numa_pools()
+     *
+     * pools[i] serves producers on the i-th online NUMA node, which is node i
+     * unless node ids have gaps (see slog::numa_nodes()). Producers on nodes
+     * beyond the end of the list use pools[0]. This implies
+     * set_numa_pools(true).
+     */
+    void set_node_pools(std::vector<std::shared_ptr<LogRecordPool>> pools)
+    {
+        nodePools = pools;
+        numaPools = !pools.empty();
+    }
+
     /**
      * @brief Set which thread this channel should operate on.
      * Id values don't have any intrinsic meaning.  If they match another LogConfig,
@@ -116,9 +247,238 @@ class LogConfig
      */
     void set_worker_thread_id(int id) { workerThreadId = id; }
 
+    /**
+     * @brief Let the application write this channel's records by calling
+     * slog::drain() from its own event loop, instead of using a worker thread.
+     * slog::event_fd() becomes readable when there are records to write.
+     *
+     * Records still queued at stop_logger() or exit are written by the thread
+     * that stops the logger. A signal handler can't safely write them, so it
+     * makes slog::event_fd() readable and waits for the next slog::drain()
+     * call to write them. Records are lost if no call comes within a second
+     * past the drain deadline. Don't wait on these channels (flush() or
+     * set_sync_severity()) from the thread that drains them.
+     */
+    void set_external_drain(bool doit = true) { externalDrain = doit; }
+
+    /// Check if the application drains this channel
+    bool get_external_drain() const { return externalDrain; }
+
+    /**
+     * @brief Service this channel from a pool of threads shared with other
+     * pooled channels, instead of a worker thread set by set_worker_thread_id().
+     *
+     * Idle pool threads pick up whichever pooled channel has records waiting,
+     * so one busy channel doesn't leave the other threads idle. Each channel
+     * is still written by one thread at a time, in order. There is one pool;
+     * its size is the largest thread_count given by any channel.
+     */
+    void set_worker_pool(int thread_count) { workerPoolThreads = thread_count; }
+
+    /// Get the shared pool size requested by this channel (0 if not pooled)
+    int get_worker_pool() const { return workerPoolThreads; }
+
+    /**
+     * @brief Give important records their own queue lanes on this channel's worker.
+     *
+     * With a single FIFO, a CRIT record waits behind any backlog of DBUG
+     * records. With lanes, records with severity <= lane_thresholds[i] go to
+     * lane i (thresholds ascending), and everything else to a final lane. The
+     * worker drains lanes according to scheduling. For WEIGHTED_PRIORITY,
+     * weights[i] records are taken from lane i per round; missing weights
+     * are 1. Lanes reorder records, including those from a single thread; see
+     * set_preserve_order(). If several channels share a worker, the first
+     * channel with lanes configures them.
+     */
+    void set_priority_lanes(LaneScheduling scheduling, std::vector<int> lane_thresholds = {ERRR, NOTE},
+                            std::vector<int> weights = {16, 4, 1})
+    {
+        laneScheduling = scheduling;
+        laneThresholds = lane_thresholds;
+        laneWeights = weights;
+    }
+
+    /**
+     * @brief Write each batch of records taken from the worker queue in
+     * timestamp order. Lanes still decide which records make the batch.
+     */
+    void set_preserve_order(bool doit = true) { preserveOrder = doit; }
+
+    /**
+     * @brief Stage records in a per-thread list and publish them to the worker
+     * queue as one batch. This takes the queue lock once per batch instead of
+     * once per record.
+     *
+     * A thread's stage is published when it holds max_records records, when
+     * its oldest record is max_delay_ms old (the worker checks), when the
+     * thread calls slog::flush_thread() or exits, or at once for records with
+     * severity <= immediate_severity. A max_records of 1 or less disables
+     * batching (the default). Batching delays records, so a crash can lose a
+     * staged record that would otherwise have been written.
+     */
+    void set_thread_batching(int max_records, long max_delay_ms = 10, int immediate_severity = WARN)
+    {
+        batchRecords = max_records;
+        batchDelayMs = max_delay_ms;
+        batchImmediateSeverity = immediate_severity;
+    }
+
+    /**
+     * @brief Format this channel's records on up to threads threads (the
+     * worker plus threads - 1 helpers) while the worker writes them in order.
+     *
+     * This helps when formatting, rather than I/O, limits a busy channel. The
+     * sink must support it (FileSink, BinarySink and ConsoleSink do; see
+     * LogSink::can_format_in_parallel()); otherwise this has no effect. The
+     * sink is flushed whenever the worker catches up with its queue, instead
+     * of once per record.
+     */
+    void set_format_threads(int threads) { formatThreads = threads; }
+
+    /// Get the number of threads formatting this channel's records
+    int get_format_threads() const { return formatThreads; }
+
+    /**
+     * @brief Make the logging thread wait until records with severity <=
+     * severity have been written and the sink synced (see LogSink::sync()).
+     * Other records stay asynchronous. The worker syncs once per batch, so
+     * several waiting threads share the cost. By default no records wait.
+     * Records that overflow to a SPILL pool's file do not wait.
+     */
+    void set_sync_severity(int severity) { syncSeverity = severity; }
+
+    /// Get the severity at or below which records are written synchronously
+    int get_sync_severity() const { return syncSeverity; }
+
+    /**
+     * @brief Collapse runs of identical records, as syslogd does. The worker
+     * writes the first record of a run, drops the rest, and then writes "last
+     * message repeated N times" when a different record arrives or after
+     * max_delay_ms. Records match if their message, tag, severity, call site
+     * and LogContextScope match. This saves sink I/O when one message floods the log. Off by
+     * default.
+     */
+    void set_duplicate_coalescing(bool coalesce, long max_delay_ms = 1000)
+    {
+        coalesceDuplicates = coalesce;
+        coalesceDelayMs = max_delay_ms;
+    }
+
+    /// Check if the worker collapses runs of identical records
+    bool get_duplicate_coalescing() const { return coalesceDuplicates; }
+
+    /// Get the longest time a repeat count is held back
+    long get_duplicate_delay() const { return coalesceDelayMs; }
+
+    /**
+     * @brief Drop less severe records while the worker falls behind, rather
+     * than blocking or dropping records at random.
+     *
+     * The worker measures pressure as the fraction of the pool that is in use
+     * (or queued). After pressure has stayed at or above high_water for
+     * interval_ms, the channel starts rejecting DBUG records in will_log(), so
+     * the macros skip them. Each further interval_ms of pressure sheds the
+     * next severity too (INFO, then NOTE). WARN and more severe records are
+     * never shed. Once pressure has stayed at or below low_water for
+     * interval_ms, the channel takes back one severity per interval_ms. Each
+     * change is logged as a WARN record tagged "slog". A high_water of zero
+     * (the default) disables shedding.
+     */
+    void set_load_shedding(double high_water, double low_water = 0.25, long interval_ms = 100)
+    {
+        shedHighWater = high_water;
+        shedLowWater = low_water;
+        shedIntervalMs = interval_ms;
+    }
+
+    /// Get the pool fraction that starts load shedding (zero if disabled)
+    double get_shed_high_water() const { return shedHighWater; }
+
+    /// Get the pool fraction that ends load shedding
+    double get_shed_low_water() const { return shedLowWater; }
+
+    /// Get how long pressure must last before each shedding step
+    long get_shed_interval() const { return shedIntervalMs; }
+
+    /// Get the largest per-thread batch (1 or less if batching is off)
+    int get_batch_records() const { return batchRecords; }
+
+    /// Get the longest time a record may wait in a per-thread batch
+    long get_batch_delay() const { return batchDelayMs; }
+
+    /// Get the severity at or below which batched records are published at once
+    int get_batch_immediate_severity() const { return batchImmediateSeverity; }
+
+    /// Get the lane scheduling policy
+    LaneScheduling get_lane_scheduling() const { return laneScheduling; }
+
+    /// Get the lane severity thresholds
+    std::vector<int> const& get_lane_thresholds() const { return laneThresholds; }
+
+    /// Get the lane weights
+    std::vector<int> const& get_lane_weights() const { return laneWeights; }
+
+    /// Check if the worker sorts batches by timestamp
+    bool get_preserve_order() const { return preserveOrder; }
+
     /// Get the thread id for this channel
     int get_worker_thread_id() const { return workerThreadId; }
 
+    /**
+     * @brief Pin the worker thread for this channel to the CPUs of a NUMA node.
+     * A negative node leaves the worker unpinned (the default). If several
+     * channels share a worker, the first pinned channel decides the node.
+     */
+    void set_worker_numa_node(int node) { workerNumaNode = node; }
+
+    /// Get the NUMA node for this channel's worker (negative if unpinned)
+    int get_worker_numa_node() const { return workerNumaNode; }
+
+    /**
+     * @brief Restrict the worker thread for this channel to the listed CPUs,
+     * such as housekeeping cores kept clear of latency-critical threads. An
+     * empty list (the default) leaves the worker unpinned. This overrides
+     * set_worker_numa_node(). If several channels share a worker, the first of
+     * them decides its CPUs, scheduling and name.
+     */
+    void set_worker_cpus(std::vector<int> cpus) { workerCpus = std::move(cpus); }
+
+    /// Get the CPUs for this channel's worker (empty if unpinned)
+    std::vector<int> const& get_worker_cpus() const { return workerCpus; }
+
+    /**
+     * @brief Set the scheduling class and nice value of the worker thread for
+     * this channel. A nice of zero leaves the inherited value. Raising priority
+     * (negative nice) needs CAP_SYS_NICE.
+     */
+    void set_worker_scheduling(WorkerScheduling scheduling, int nice = 0)
+    {
+        workerScheduling = scheduling;
+        workerNice = nice;
+    }
+
+    /// Get the scheduling class of this channel's worker
+    WorkerScheduling get_worker_scheduling() const { return workerScheduling; }
+
+    /// Get the nice value of this channel's worker (zero if inherited)
+    int get_worker_nice() const { return workerNice; }
+
+    /**
+     * @brief Name the worker thread for this channel, as shown by top and perf.
+     * Names are cut to 15 characters. By default, workers are named
+     * "slog-<id>" and pool threads "slog-pool".
+     */
+    void set_worker_name(std::string name) { workerName = std::move(name); }
+
+    /// Get the name of this channel's worker (empty for the default)
+    std::string const& get_worker_name() const { return workerName; }
+
+    /// Check if this channel uses per-NUMA-node pools
+    bool get_numa_pools() const { return numaPools; }
+
+    /// Get the per-node pools (empty unless set_node_pools() was called)
+    std::vector<std::shared_ptr<LogRecordPool>> const& get_node_pools() const { return nodePools; }
+
     /// Get the current sink
     std::shared_ptr<LogSink> const& get_sink() { return sink; }
 
@@ -130,7 +490,30 @@ class LogConfig
 
   private:
     int workerThreadId;
+    int workerPoolThreads;
+    bool externalDrain;
+    int workerNumaNode;
+    std::vector<int> workerCpus;
+    WorkerScheduling workerScheduling;
+    int workerNice;
+    std::string workerName;
+    bool numaPools;
+    LaneScheduling laneScheduling;
+    std::vector<int> laneThresholds;
+    std::vector<int> laneWeights;
+    bool preserveOrder;
+    int batchRecords;
+    long batchDelayMs;
+    int batchImmediateSeverity;
+    int syncSeverity;
+    int formatThreads;
+    bool coalesceDuplicates;
+    long coalesceDelayMs;
+    double shedHighWater;
+    double shedLowWater;
+    long shedIntervalMs;
     std::shared_ptr<LogRecordPool> pool;
+    std::vector<std::shared_ptr<LogRecordPool>> nodePools;
     std::shared_ptr<LogSink> sink;
     ThresholdMap threshold;
 };
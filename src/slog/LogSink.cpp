@@ -1,18 +1,65 @@
 #include "LogSink.hpp"
 
+#include <algorithm>
 #include <cstdint>
+#include <cerrno>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
 
 #include "ConsoleSink.hpp"
+#include "LogContext.hpp"
 #include "SlogConfig.hpp"
 #include "PlatformUtilities.hpp"
+#include "SlogError.hpp"
 #include "slog/Timestamp.hpp"
 
 namespace slog
 {
 
+FormatBuffer::FormatBuffer()
+    : buffer(nullptr),
+      length(0)
+{
+    stream = open_memstream(&buffer, &length);
+    if (nullptr == stream) {
+        slog_error("Could not open a format buffer -- %s\n", strerror(errno));
+    }
+}
+
+FormatBuffer::~FormatBuffer()
+{
+    if (stream) {
+        fclose(stream);
+    }
+    free(buffer);
+}
+
+void FormatBuffer::clear()
+{
+    if (stream) {
+        // The memstream's size follows the write position
+        fseek(stream, 0, SEEK_SET);
+    }
+}
+
+char const* FormatBuffer::data()
+{
+    if (stream) {
+        fflush(stream);
+    }
+    return buffer;
+}
+
+std::size_t FormatBuffer::size()
+{
+    if (stream) {
+        fflush(stream);
+    }
+    return length;
+}
+
 char const* severity_string(int severity)
 {
     if (severity >= DBUG) {
@@ -70,6 +117,20 @@ long write_message_to_file(FILE* sink, LogRecord const& rec)
 }
 
 
+long write_context_to_file(FILE* sink, LogRecord const& rec)
+{
+    LogContext const* context = rec.meta().context();
+    if (nullptr == context) {
+        return 0;
+    }
+    long write_count = 0;
+    context->for_each([sink, &write_count](char const* key, char const* value) {
+        int written = fprintf(sink, " %s=%s", key, value);
+        write_count += std::max(written, 0);
+    });
+    return write_count;
+}
+
 long default_format(FILE* sink, LogRecord const& rec)
 {
     char time_str[32];
@@ -86,6 +147,7 @@ long default_format(FILE* sink, LogRecord const& rec)
         write_count++;
     }
     write_count += fwrite(time_str, sizeof(char), strnlen(time_str, sizeof(time_str)), sink);
+    write_count += write_context_to_file(sink, rec);
     write_count += fwrite("] ", sizeof(char), 2, sink);
     write_count += write_message_to_file(sink, rec);
     return write_count;
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <functional>
@@ -8,6 +9,39 @@
 namespace slog
 {
 
+/**
+ * @brief A growable in-memory FILE, so that Formatter functions can format a
+ * record away from the thread that writes it. See LogSink::format().
+ */
+class FormatBuffer
+{
+  public:
+    FormatBuffer();
+    ~FormatBuffer();
+    FormatBuffer(FormatBuffer const&) = delete;
+    FormatBuffer& operator=(FormatBuffer const&) = delete;
+
+    /// Check that the stream could be opened
+    bool ok() const { return stream != nullptr; }
+
+    /// The stream to format into
+    FILE* file() { return stream; }
+
+    /// Discard the contents
+    void clear();
+
+    /// The formatted bytes. This flushes the stream.
+    char const* data();
+
+    /// The number of formatted bytes. This flushes the stream.
+    std::size_t size();
+
+  private:
+    FILE* stream;
+    char* buffer;
+    std::size_t length;
+};
+
 /**
  * @brief Base class for all log sinks.
  *
@@ -23,6 +57,36 @@ class LogSink
 
     /// Notification that logging is done (i.e. close up any files)
     virtual void finalize() {}
+
+    /// Push any buffered output to the device. Called for slog::flush().
+    virtual void flush() {}
+
+    /**
+     * Make everything recorded so far durable (e.g. fdatasync a file). Called
+     * for records at or above LogConfig::set_sync_severity(). The default
+     * just calls flush().
+     */
+    virtual void sync() { flush(); }
+
+    /**
+     * @brief Sinks that can turn a record into bytes apart from writing it
+     * return true and override format() and write_formatted(). This lets
+     * LogConfig::set_format_threads() format records on several threads.
+     */
+    virtual bool can_format_in_parallel() const { return false; }
+
+    /**
+     * @brief Format a record into out. This may be called on several threads
+     * at once, so it must not touch mutable sink state.
+     */
+    virtual void format(LogRecord const&, FormatBuffer&) {}
+
+    /**
+     * @brief Write the output of format() for one record. This is called on
+     * the worker thread in record order. flush() is called once the worker
+     * has caught up with its queue, or for slog::flush().
+     */
+    virtual void write_formatted(LogRecord const&, char const*, std::size_t) {}
 };
 
 /**
@@ -83,10 +147,18 @@ uint32_t total_record_size(LogRecord const& node);
 long write_message_to_file(FILE* sink, LogRecord const& rec);
 
 /**
- * @brief The default record format: "[SEVR TAG YYYY-MM-DD hh:mm:ss.sssZ]"
+ * @brief Write " key=value" for each pair in the record's LogContext, outermost
+ * scope first. Writes nothing if the record has no context.
+ * @return Number of bytes written
+ */
+long write_context_to_file(FILE* sink, LogRecord const& rec);
+
+/**
+ * @brief The default record format: "[SEVR TAG YYYY-MM-DD hh:mm:ss.sssZ key=value]"
  *
  * SEVR is the four character severity code from format_severity(), TAG is the
- * optional tag (if no tag, then nothing is printed).
+ * optional tag (if no tag, then nothing is printed). The key=value pairs come
+ * from the record's LogContext, if any.
  */
 long default_format(FILE* sink, LogRecord const& node);
 
@@ -1,33 +1,67 @@
 #include "LogWorker.hpp"
 #include "LogChannel.hpp"
 #include "LogRecord.hpp"
+#include "LogSink.hpp"
+#include "PlatformUtilities.hpp"
 #include "Signal.hpp"
+#include "WorkerPool.hpp"
+#include <algorithm>
 #include <cassert>
+#include <limits>
 
 namespace slog
 {
-// This controls how fast the worker thread loop responds
-// to signals to shut down.  50 ms is generally too short
-// to notice at the console.
+// This controls how often an idle worker does housekeeping. Stops and
+// signals wake the worker at once (unless it found no free wake word).
 constexpr std::chrono::milliseconds WAIT{50};
 
-LogWorker::LogWorker() = default;
+// Records taken from the queue at once. Smaller batches let important lanes
+// jump ahead sooner; larger ones take the queue lock less often.
+constexpr std::size_t BATCH_SIZE = 64;
+
+LogWorker::LogWorker()
+    : preserve_order(false),
+      stage_delay_ns(0),
+      retired(false),
+      shared_pool(nullptr),
+      pool_state(0)
+{
+    batch.reserve(BATCH_SIZE);
+}
+
+void LogWorker::set_priority_lanes(LaneScheduling scheduling, std::vector<int> const& lane_thresholds,
+                                   std::vector<int> const& weights)
+{
+    assert(!worker.joinable());
+    record_queue.configure(scheduling, lane_thresholds, weights);
+}
 
 LogWorker::~LogWorker() { stop(); }
 
 void LogWorker::stop()
 {
-    if (!worker.joinable()) {
-        channel_list.clear();
-        return;
+    if (worker.joinable()) {
+        if (!retired && get_signal_state() == SLOG_ACTIVE) {
+            set_signal_state(SLOG_STOPPED);
+        }
+        worker.join();
+    }
+    if (retired) {
+        drop_queued(); // Pushed after the thread exited
     }
-    if (get_signal_state() == SLOG_ACTIVE) {
-        set_signal_state(SLOG_STOPPED);
-    }    
-    worker.join();    
     channel_list.clear();
 }
 
+void LogWorker::retire() { retired.store(true); }
+
+void LogWorker::join()
+{
+    assert(retired);
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
 void LogWorker::add_channel(int channel_id, std::shared_ptr<LogChannel> channel)
 {
     assert(!worker.joinable());
@@ -37,55 +71,481 @@ void LogWorker::add_channel(int channel_id, std::shared_ptr<LogChannel> channel)
     channel_list[channel_id] = std::move(channel);
 }
 
+void LogWorker::set_pool(WorkerPool* pool)
+{
+    assert(!worker.joinable());
+    shared_pool = pool;
+    record_queue.set_pool(pool, this);
+}
+
 void LogWorker::start()
 {
-    if (worker.joinable()) {
-        return;
+    if (worker.joinable() || shared_pool) {
+        return; // A WorkerPool runs pooled workers
     }
     notify_worker_starting();
-    worker = std::thread([this]() { this->work(); });
+    worker = std::thread([this]() {
+        thread_placement.apply();
+        this->work();
+    });
+}
+
+ThreadPlacement::ThreadPlacement()
+    : numa_node(-1),
+      scheduling(NORMAL_SCHEDULING),
+      nice(0)
+{
+}
+
+void ThreadPlacement::apply() const
+{
+    if (!name.empty()) {
+        set_thread_name(name.c_str());
+    }
+    if (!cpus.empty()) {
+        bind_thread_to_cpus(cpus);
+    } else if (numa_node >= 0) {
+        bind_thread_to_numa_node(numa_node);
+    }
+    if (scheduling != NORMAL_SCHEDULING || nice != 0) {
+        set_thread_scheduling(scheduling, nice);
+    }
+}
+
+namespace
+{
+long long steady_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+} // namespace
+
+/// Runs an action once a marker has come out of every queue lane
+struct Barrier {
+    std::unique_ptr<LogControl> action;
+    std::size_t remaining; // Only touched by the worker
+};
+
+class BarrierMarker : public LogControl
+{
+  public:
+    explicit BarrierMarker(std::shared_ptr<Barrier> barrier_)
+        : barrier(std::move(barrier_))
+    {
+    }
+
+    void run() override
+    {
+        if (--barrier->remaining == 0) {
+            barrier->action->run();
+        }
+    }
+
+    void discard() override
+    {
+        if (--barrier->remaining == 0) {
+            barrier->action->discard();
+        }
+    }
+
+  private:
+    std::shared_ptr<Barrier> barrier;
+};
+
+void LogWorker::push_barrier(int channel_id, LogControl* action)
+{
+    // Lanes are served out of order, so one marker per lane is needed to be
+    // sure every earlier record has been written.
+    std::shared_ptr<Barrier> barrier = std::make_shared<Barrier>();
+    barrier->action.reset(action);
+    barrier->remaining = record_queue.lane_count();
+    std::vector<LogRecord*> markers;
+    for (std::size_t i = 0; i < barrier->remaining; i++) {
+        markers.push_back(LogRecord::make_control(channel_id, new BarrierMarker(barrier)));
+    }
+    record_queue.push_to_each_lane(markers);
+}
+
+LogWorker::ThreadStage::ThreadStage(LogWorker* owner)
+    : worker(owner),
+      head(nullptr),
+      tail(nullptr),
+      count(0),
+      first_ns(0)
+{
+}
+
+std::shared_ptr<LogWorker::ThreadStage> LogWorker::make_stage()
+{
+    std::shared_ptr<ThreadStage> new_stage = std::make_shared<ThreadStage>(this);
+    std::unique_lock<std::mutex> guard(stage_lock);
+    stages.push_back(new_stage);
+    return new_stage;
+}
+
+void LogWorker::set_stage_delay(long delay_ms)
+{
+    assert(!worker.joinable());
+    long long delay_ns = std::max(1LL, delay_ms * 1000000LL);
+    if (stage_delay_ns == 0 || delay_ns < stage_delay_ns) {
+        stage_delay_ns = delay_ns;
+    }
+}
+
+void LogWorker::stage(ThreadStage& stage, LogRecord* record, int max_records, int immediate_severity)
+{
+    int severity = record->meta().severity();
+    record->m_next = nullptr;
+    std::unique_lock<std::mutex> guard(stage.lock);
+    if (stage.tail) {
+        stage.tail->m_next = record;
+    } else {
+        stage.head = record;
+        stage.first_ns = steady_ns();
+    }
+    stage.tail = record;
+    stage.count++;
+    if (stage.count >= max_records || severity <= immediate_severity) {
+        publish_locked(stage);
+    }
+    guard.unlock();
+    if (severity == FATL) {
+        std::abort();
+    }
+}
+
+void LogWorker::publish(ThreadStage& stage)
+{
+    std::unique_lock<std::mutex> guard(stage.lock);
+    publish_locked(stage);
+}
+
+void LogWorker::publish_locked(ThreadStage& stage)
+{
+    // The queue is pushed with the stage still locked, so batches from one
+    // thread reach the queue in order.
+    if (stage.head) {
+        record_queue.push_batch(stage.head);
+        stage.head = stage.tail = nullptr;
+        stage.count = 0;
+    }
+}
+
+void LogWorker::publish_stages(bool everything)
+{
+    long long now = steady_ns();
+    std::unique_lock<std::mutex> guard(stage_lock);
+    for (auto it = stages.begin(); it != stages.end();) {
+        ThreadStage& stage = **it;
+        if (everything) {
+            // A signal may have interrupted the owner while it held the lock.
+            // Skip the stage rather than deadlock.
+            std::unique_lock<std::mutex> stage_guard(stage.lock, std::try_to_lock);
+            if (stage_guard.owns_lock()) {
+                publish_locked(stage);
+            }
+        } else {
+            std::unique_lock<std::mutex> stage_guard(stage.lock);
+            if (stage.count && now - stage.first_ns >= stage_delay_ns) {
+                publish_locked(stage);
+            }
+        }
+        // Forget the stages of threads that have exited
+        if (it->use_count() == 1 && stage.count == 0) {
+            it = stages.erase(it);
+        } else {
+            ++it;
+        }
+    }
 }
 
 void LogWorker::work()
+{
+    std::chrono::milliseconds wait = WAIT;
+    if (stage_delay_ns > 0) {
+        wait = std::min(wait, std::chrono::milliseconds(std::max(1LL, stage_delay_ns / 1000000)));
+    }
+    while (get_signal_state() == SLOG_ACTIVE && !retired) {
+        run_once(wait);
+    }
+    if (retired) {
+        drop_queued();
+    } else {
+        drain();
+    }
+    notify_worker_stopping();
+}
+
+std::size_t LogWorker::run_once(std::chrono::milliseconds wait, std::size_t max_records)
 {
     // Note: If we encounter channel_id's we don't know, there's little we can do.
     // If we ignore the node, then we leak the resource because we don't know which
     // pool to return it to.
-    while (get_signal_state() == SLOG_ACTIVE) {
-        LogRecord* node = record_queue.pop(WAIT);
-        if (node) {
-            int channel_id = node->meta().channel();
-            assert(channel_id >= 0 && channel_id < (int)channel_list.size());
-            auto& channel = channel_list[channel_id];
-            assert(channel);
-            channel->send_to_sink(node);
-        }
-    }
-    // Drain the queue
-    LogRecord* head = record_queue.pop_all();
-    while (head) {
-        int channel_id = head->meta().channel();
-        assert(channel_id >= 0 && channel_id < (int)channel_list.size());
-        auto& channel = channel_list[channel_id];
-        assert(channel);
-        LogRecord* next = head->m_next;
-        channel->send_to_sink(head);
-        head = next;
-    }
-    for (auto& channel : channel_list) {
-        if (channel) {
-            channel->finalize();
+    std::size_t taken = record_queue.pop_batch(
+        batch, max_records > 0 ? std::min(max_records, BATCH_SIZE) : BATCH_SIZE, wait);
+    sort_batch();
+    dispatch_batch();
+    if (!syncs.empty()) {
+        complete_syncs();
+    }
+    if (stage_delay_ns > 0) {
+        publish_stages(false);
+    }
+    // Move pool growth (and shrinking) off of the producer threads
+    long depth = record_queue.size();
+    for (std::size_t id = 0; id < channel_list.size(); id++) {
+        if (channel_list[id]) {
+            if (0 == depth) {
+                channel_list[id]->flush_if_written(); // Caught up, so nothing more is coming soon
+            }
+            channel_list[id]->maintain_pools();
+            channel_list[id]->report_drops((int)id);
+            channel_list[id]->report_repeats();
+            channel_list[id]->shed_load((int)id, depth);
         }
     }
-    notify_worker_stopping();
+    return taken;
+}
+
+void LogWorker::drain()
+{
+    // Drain the stages and queue. Other workers drain at the same time.
+    publish_stages(true);
+    long long deadline = get_drain_deadline_ns();
+    long long stop_by = deadline > 0 ? steady_ns() + deadline : 0;
+    // Batches still go through the lanes, so shutdown doesn't change the order.
+    // Once the queue is empty, close it so that late sync pushes can't wait
+    // forever, then take what arrived just before it closed.
+    bool closed = false;
+    while (true) {
+        if (record_queue.pop_batch(batch, BATCH_SIZE, std::chrono::milliseconds(0)) == 0) {
+            if (closed) {
+                break;
+            }
+            record_queue.close();
+            closed = true;
+            continue;
+        }
+        sort_batch();
+        if (0 == stop_by) {
+            dispatch_batch();
+        } else {
+            for (LogRecord* node : batch) {
+                if (steady_ns() > stop_by) {
+                    dump_raw(node);
+                } else {
+                    dispatch(node);
+                }
+            }
+        }
+        if (!syncs.empty()) {
+            complete_syncs();
+        }
+    }
+    for (std::size_t id = 0; id < channel_list.size(); id++) {
+        if (channel_list[id]) {
+            channel_list[id]->report_drops((int)id);
+            channel_list[id]->finalize();
+        }
+    }
+}
+
+LogCompletion::LogCompletion()
+    : done(false)
+{
 }
 
-LogRecord* LogWorker::LogQueue::pop_all()
+void LogCompletion::signal()
 {
     std::unique_lock<std::mutex> guard(lock);
-    LogRecord* popped = head;
-    head = tail = nullptr;
-    return popped;
+    done = true;
+    signalled.notify_one();
+}
+
+void LogCompletion::wait()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    signalled.wait(guard, [this]() { return done; });
+    done = false;
+}
+
+void LogWorker::push_and_wait(LogRecord* rec, LogCompletion& completion)
+{
+    int severity = rec->meta().severity();
+    rec->m_completion = &completion;
+    if (record_queue.push_unless_closed(rec)) {
+        completion.wait();
+    } else {
+        // The worker has drained for a stop, so nobody would answer
+        rec->m_completion = nullptr;
+        dump_raw(rec);
+    }
+    if (severity == FATL) {
+        std::abort();
+    }
+}
+
+void LogWorker::complete_syncs()
+{
+    // One sync per channel covers every record in the batch
+    for (auto it = syncs.begin(); it != syncs.end(); ++it) {
+        auto earlier = std::find_if(syncs.begin(), it, [it](PendingSync const& other) {
+            return other.channel_id == it->channel_id;
+        });
+        if (earlier == it) {
+            channel_list[it->channel_id]->sync();
+        }
+    }
+    for (PendingSync const& pending : syncs) {
+        pending.completion->signal();
+    }
+    syncs.clear();
+}
+
+void LogWorker::dispatch_batch()
+{
+    std::size_t i = 0;
+    while (i < batch.size()) {
+        LogRecord* node = batch[i];
+        if (retired.load(std::memory_order_relaxed) && !node->m_control) {
+            drop(node); // Queued behind the barrier that retired the worker
+            i++;
+            continue;
+        }
+        if (node->m_control || !channel_list[node->meta().channel()]->formats_in_parallel()) {
+            dispatch(node);
+            i++;
+            continue;
+        }
+        int channel_id = node->meta().channel();
+        std::size_t end = i;
+        for (; end < batch.size() && !batch[end]->m_control && batch[end]->meta().channel() == channel_id; end++) {
+            if (batch[end]->m_completion) {
+                syncs.push_back(PendingSync{channel_id, batch[end]->m_completion});
+            }
+        }
+        channel_list[channel_id]->send_batch_to_sink(&batch[i], end - i);
+        i = end;
+    }
+}
+
+void LogWorker::dump_raw(LogRecord* node)
+{
+    if (node->m_control) {
+        LogRecord::discard_control(node);
+        return;
+    }
+    int fd = get_drain_fallback_fd();
+    append_to_file(fd, severity_string(node->meta().severity()), 4);
+    append_to_file(fd, " ", 1);
+    for (LogRecord const* part = node; part != nullptr; part = part->more()) {
+        uint32_t size = part->size();
+        if (size > 0 && part->message()[size - 1] == '\0') {
+            size--;
+        }
+        append_to_file(fd, part->message(), size);
+    }
+    append_to_file(fd, "\n", 1);
+    if (node->m_completion) {
+        node->m_completion->signal();
+    }
+    channel_list[node->meta().channel()]->dispose_of_record(node);
+}
+
+void LogWorker::drop(LogRecord* node)
+{
+    auto& channel = channel_list[node->meta().channel()];
+    channel->count_drop(node->meta().severity());
+    if (node->m_completion) {
+        node->m_completion->signal();
+    }
+    channel->dispose_of_record(node);
+}
+
+void LogWorker::drop_queued()
+{
+    publish_stages(true);
+    record_queue.close();
+    while (record_queue.pop_batch(batch, BATCH_SIZE, std::chrono::milliseconds(0)) > 0) {
+        for (LogRecord* node : batch) {
+            if (node->m_control) {
+                LogRecord::run_control(node);
+            } else {
+                drop(node);
+            }
+        }
+    }
+}
+
+void LogWorker::sort_batch()
+{
+    if (preserve_order) {
+        std::stable_sort(batch.begin(), batch.end(), [](LogRecord const* a, LogRecord const* b) {
+            return a->meta().time() < b->meta().time();
+        });
+    }
+}
+
+void LogWorker::dispatch(LogRecord* node)
+{
+    if (node->m_control) {
+        LogRecord::run_control(node);
+        return;
+    }
+    int channel_id = node->meta().channel();
+    assert(channel_id >= 0 && channel_id < (int)channel_list.size());
+    auto& channel = channel_list[channel_id];
+    assert(channel);
+    if (node->m_completion) {
+        syncs.push_back(PendingSync{channel_id, node->m_completion});
+    }
+    channel->send_to_sink(node);
+}
+
+LogWorker::LogQueue::LogQueue()
+    : wake_word(claim_wake_word()),
+      own_wake_word(0),
+      sleeping(false),
+      pool(nullptr),
+      owner(nullptr),
+      lanes(1, Lane{nullptr, nullptr, std::numeric_limits<int>::max(), 1}),
+      scheduling(SINGLE_LANE),
+      closed(false),
+      depth(0),
+      cursor(0),
+      credit(1)
+{
+    if (nullptr == wake_word) {
+        wake_word = &own_wake_word; // Stops are then noticed within WAIT
+    }
+}
+
+LogWorker::LogQueue::~LogQueue()
+{
+    if (wake_word != &own_wake_word) {
+        release_wake_word(wake_word);
+    }
+}
+
+void LogWorker::LogQueue::configure(LaneScheduling new_scheduling, std::vector<int> const& lane_thresholds,
+                                    std::vector<int> const& weights)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    assert(depth == 0);
+    scheduling = new_scheduling;
+    lanes.clear();
+    if (scheduling != SINGLE_LANE) {
+        for (int threshold : lane_thresholds) {
+            lanes.push_back(Lane{nullptr, nullptr, threshold, 1});
+        }
+    }
+    lanes.push_back(Lane{nullptr, nullptr, std::numeric_limits<int>::max(), 1});
+    for (std::size_t i = 0; i < lanes.size() && i < weights.size(); i++) {
+        lanes[i].weight = std::max(1, weights[i]);
+    }
+    cursor = 0;
+    credit = lanes[0].weight;
 }
 
 void LogWorker::LogQueue::push(LogRecord* node)
@@ -93,34 +553,160 @@ void LogWorker::LogQueue::push(LogRecord* node)
     assert(node);
     node->m_next = nullptr;
     std::unique_lock<std::mutex> guard(lock);
-    if (tail) {
-        tail->m_next = node;
-        tail = node;
-    } else {
-        tail = head = node;
+    enqueue(node);
+    guard.unlock();
+    wake();
+}
+
+bool LogWorker::LogQueue::push_unless_closed(LogRecord* node)
+{
+    assert(node);
+    node->m_next = nullptr;
+    std::unique_lock<std::mutex> guard(lock);
+    if (closed) {
+        return false;
     }
+    enqueue(node);
     guard.unlock();
-    pending.notify_one();
+    wake();
+    return true;
+}
+
+void LogWorker::LogQueue::close()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    closed = true;
 }
 
-LogRecord* LogWorker::LogQueue::pop(std::chrono::milliseconds wait)
+void LogWorker::LogQueue::push_batch(LogRecord* list)
 {
-    auto condition = [this]() -> bool { return head != nullptr; };
-    LogRecord* popped = nullptr;
+    std::unique_lock<std::mutex> guard(lock);
+    while (list) {
+        LogRecord* node = list;
+        list = list->m_next;
+        node->m_next = nullptr;
+        enqueue(node);
+    }
+    guard.unlock();
+    wake();
+}
 
+void LogWorker::LogQueue::push_to_each_lane(std::vector<LogRecord*> const& records)
+{
     std::unique_lock<std::mutex> guard(lock);
-    if (pending.wait_for(guard, wait, condition)) {
-        popped = head;
-        head = head->m_next;
-        if (nullptr == head) {
-            tail = nullptr;
+    assert(records.size() == lanes.size());
+    for (std::size_t i = 0; i < lanes.size(); i++) {
+        LogRecord* node = records[i];
+        node->m_next = nullptr;
+        if (lanes[i].tail) {
+            lanes[i].tail->m_next = node;
+            lanes[i].tail = node;
+        } else {
+            lanes[i].tail = lanes[i].head = node;
         }
-        guard.unlock();
-        popped->m_next = nullptr;
+        depth++;
+    }
+    guard.unlock();
+    wake();
+}
+
+void LogWorker::LogQueue::enqueue(LogRecord* node)
+{
+    int severity = node->meta().severity();
+    std::size_t index = 0;
+    while (severity > lanes[index].threshold) {
+        index++; // The last lane takes everything
+    }
+    Lane& lane = lanes[index];
+    if (lane.tail) {
+        lane.tail->m_next = node;
+        lane.tail = node;
+    } else {
+        lane.tail = lane.head = node;
+    }
+    depth++;
+}
+
+LogRecord* LogWorker::LogQueue::pop_lane(Lane& lane)
+{
+    LogRecord* popped = lane.head;
+    lane.head = popped->m_next;
+    if (nullptr == lane.head) {
+        lane.tail = nullptr;
     }
+    popped->m_next = nullptr;
+    depth--;
     return popped;
 }
 
+void LogWorker::LogQueue::set_pool(WorkerPool* new_pool, LogWorker* new_owner)
+{
+    pool = new_pool;
+    owner = new_owner;
+    if (pool && wake_word != &own_wake_word) {
+        // Pool threads wait on the pool's word, so free this one for others
+        release_wake_word(wake_word);
+        wake_word = &own_wake_word;
+    }
+}
+
+long LogWorker::LogQueue::size()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    return depth;
+}
+
+void LogWorker::LogQueue::wake()
+{
+    if (pool) {
+        pool->schedule(owner);
+        return;
+    }
+    if (sleeping.load()) {
+        (*wake_word)++;
+        futex_wake(*wake_word, 1);
+    }
+}
+
+std::size_t LogWorker::LogQueue::pop_batch(std::vector<LogRecord*>& batch, std::size_t max_count,
+                                           std::chrono::milliseconds wait)
+{
+    batch.clear();
+    // Announce the sleep before checking depth, so a producer that pushes
+    // after the check is sure to see it and bump the word
+    sleeping.store(true);
+    int seen = wake_word->load();
+    std::unique_lock<std::mutex> guard(lock);
+    if (depth == 0 && wait.count() > 0) {
+        guard.unlock();
+        futex_wait(*wake_word, seen, std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count());
+        guard.lock();
+    }
+    sleeping.store(false);
+    if (depth == 0) {
+        return 0; // Timed out, or woken by a signal
+    }
+    if (scheduling == WEIGHTED_PRIORITY) {
+        while (batch.size() < max_count && depth > 0) {
+            Lane& lane = lanes[cursor];
+            if (lane.head && credit > 0) {
+                batch.push_back(pop_lane(lane));
+                credit--;
+            } else {
+                cursor = (cursor + 1) % lanes.size();
+                credit = lanes[cursor].weight;
+            }
+        }
+    } else {
+        for (Lane& lane : lanes) {
+            while (batch.size() < max_count && lane.head) {
+                batch.push_back(pop_lane(lane));
+            }
+        }
+    }
+    return batch.size();
+}
+
 int LogWorker::channel_count() const
 {
     int num_channel = 0;
@@ -1,14 +1,58 @@
 #pragma once
 #include "LogChannel.hpp"
 #include "LogRecord.hpp"
+#include "LogSetup.hpp"
+#include <atomic>
+#include <condition_variable>
 #include <cstdlib>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
 namespace slog
 {
 
+class WorkerPool;
+
+/**
+ * Where and how a worker thread runs. See LogConfig::set_worker_cpus().
+ */
+struct ThreadPlacement {
+    ThreadPlacement();
+
+    /// Apply to the calling thread. Failures are reported with slog_error.
+    void apply() const;
+
+    int numa_node;               // Negative leaves the thread unpinned
+    std::vector<int> cpus;       // Overrides numa_node unless empty
+    WorkerScheduling scheduling; // Only applied if not NORMAL_SCHEDULING
+    int nice;                    // Only applied if not zero
+    std::string name;            // Empty keeps the inherited name
+};
+
+/**
+ * Lets a producer wait until the worker has written and synced a record. See
+ * LogConfig::set_sync_severity().
+ */
+class LogCompletion
+{
+  public:
+    LogCompletion();
+
+    /// Wake the waiting producer. Called by the worker.
+    void signal();
+
+    /// Wait for signal(), then rearm for the next record
+    void wait();
+
+  private:
+    std::mutex lock;
+    std::condition_variable signalled;
+    bool done;
+};
+
 /**
  * A worker thread and queue for writing records to sinks
  */
@@ -27,6 +71,19 @@ class LogWorker
      */
     void push_to_queue(LogRecord* rec);
 
+    /**
+     * Send a record to the queue, then wait until it has been written and the
+     * sink synced. If the worker has already drained for a stop, the record
+     * goes to the drain fallback descriptor instead. Thread-safe.
+     */
+    void push_and_wait(LogRecord* rec, LogCompletion& completion);
+
+    /**
+     * Run action on the worker once every record queued before this call has
+     * been sent to its sink. The worker owns action. Thread safe.
+     */
+    void push_barrier(int channel_id, LogControl* action);
+
     /**
      * Add a log channel to the worker. This should only be done
      * in the stopped state.
@@ -44,6 +101,99 @@ class LogWorker
      */
     int channel_count() const;
 
+    /**
+     * Pin the work thread to the CPUs of a NUMA node. A negative node (the
+     * default) leaves the thread unpinned. Takes effect on the next start().
+     */
+    void set_numa_node(int node) { thread_placement.numa_node = node; }
+
+    /**
+     * Where the work thread runs and how it is scheduled. Changes take effect
+     * on the next start().
+     */
+    ThreadPlacement& placement() { return thread_placement; }
+
+    /**
+     * Let a WorkerPool run this worker instead of a thread of its own. Only
+     * call this before start().
+     */
+    void set_pool(WorkerPool* pool);
+
+    /// Check if a WorkerPool runs this worker
+    bool is_pooled() const { return shared_pool != nullptr; }
+
+    /**
+     * Write up to one batch of records, or max_records if that is smaller and
+     * not zero (waiting up to wait for them), then do housekeeping. Returns the
+     * number of records taken. Only one thread may run a worker at a time.
+     */
+    std::size_t run_once(std::chrono::milliseconds wait, std::size_t max_records = 0);
+
+    /**
+     * Write everything still queued after a stop, then finalize the sinks.
+     * Only one thread may drain a worker.
+     */
+    void drain();
+
+    /// Check if any records are queued. Thread safe.
+    bool has_queued() { return record_queue.size() > 0; }
+
+    /// The longest time a staged record may wait (zero if no channel batches)
+    long long get_stage_delay_ns() const { return stage_delay_ns; }
+
+    /**
+     * Split the queue into severity lanes. See LogConfig::set_priority_lanes().
+     * Only call this before start().
+     */
+    void set_priority_lanes(LaneScheduling scheduling, std::vector<int> const& lane_thresholds,
+                            std::vector<int> const& weights);
+
+    /**
+     * Sort each batch taken from the queue by timestamp before writing it.
+     * Only call this before start().
+     */
+    void set_preserve_order(bool preserve) { preserve_order = preserve; }
+
+    /**
+     * Records staged by one producer thread for one channel. See
+     * LogConfig::set_thread_batching(). The lock is only contended when the
+     * worker publishes a stage that has waited too long.
+     */
+    struct ThreadStage {
+        explicit ThreadStage(LogWorker* owner);
+
+        LogWorker* worker;
+        std::mutex lock;
+        LogRecord* head;
+        LogRecord* tail;
+        int count;
+        long long first_ns; // When the oldest staged record was staged (steady clock)
+    };
+
+    /**
+     * Make a stage for the calling thread. The worker publishes it if records
+     * sit there too long. Thread safe.
+     */
+    std::shared_ptr<ThreadStage> make_stage();
+
+    /**
+     * Add a record to a stage. The stage is published if it holds max_records,
+     * or if the record is at least as important as immediate_severity. Called
+     * on the stage's thread.
+     */
+    void stage(ThreadStage& stage, LogRecord* record, int max_records, int immediate_severity);
+
+    /**
+     * Move all staged records to the queue in one batch. Thread safe.
+     */
+    void publish(ThreadStage& stage);
+
+    /**
+     * Set the longest time a record may wait in a stage before the worker
+     * publishes it. Only call this before start().
+     */
+    void set_stage_delay(long delay_ms);
+
     /**
      * Start the worker. If already started, this has no effect. This does not
      * change the signal state to SLOG_ACTIVE. If the state isn't SLOG_ACTIVE,
@@ -55,38 +205,93 @@ class LogWorker
     /**
      * Drain any queued messages.  Join the work thread. Delete all channels.
      * @note Because all work loops are looking at the same atomic stop condition,
-     * this will stop *all* workers.
+     * this will stop *all* workers. A retired worker only stops itself.
      */
     void stop();
 
+    /**
+     * Make the work thread exit once the current record is done, without
+     * stopping other workers. Records still queued (or pushed later) are
+     * freed unwritten and counted as drops. Call this from a control action
+     * on the worker, then join() elsewhere.
+     */
+    void retire();
+
+    /// Wait for the thread of a retired worker to exit. Its channels are kept.
+    void join();
+
   private:
     /**
-     * A concurrent queue implemented as a linked list using the next pointer
+     * A concurrent queue implemented as linked lists using the next pointer
      * inside of LogRecord. This is mutex-synchronized, allowing waiting on the
      * condition variable so that the waiting thread (the LogChannel worker) can
      * be put to sleep and awoken by the OS efficiently.
+     *
+     * Records are sorted into lanes by severity. With one lane (the default),
+     * this is a plain FIFO.
+     *
+     * The worker sleeps on a futex word rather than a condition variable, so
+     * that set_signal_state() can wake it from a signal handler.
      */
     class LogQueue
     {
       public:
-        LogQueue()
-            : tail(nullptr),
-              head(nullptr)
-        {
-        }
+        LogQueue();
+        ~LogQueue();
+
+        void configure(LaneScheduling scheduling, std::vector<int> const& lane_thresholds,
+                       std::vector<int> const& weights);
 
         void push(LogRecord* record);
 
-        LogRecord* pop(std::chrono::milliseconds wait);
+        /// Push unless close() has been called. Returns false if it has.
+        bool push_unless_closed(LogRecord* record);
+
+        /// Make push_unless_closed() fail from now on
+        void close();
+
+        /// Push a list linked through m_next with one lock and one notify
+        void push_batch(LogRecord* list);
 
-        LogRecord* pop_all();
+        /// Wake a WorkerPool instead of a sleeping thread when records arrive
+        void set_pool(WorkerPool* pool, LogWorker* owner);
+
+        /// Records in all lanes
+        long size();
+
+        /// Number of lanes. Fixed while the worker runs.
+        std::size_t lane_count() const { return lanes.size(); }
+
+        /// Push records[i] onto the tail of lane i
+        void push_to_each_lane(std::vector<LogRecord*> const& records);
+
+        /// Wait for records, then move up to max_count of them into batch. Returns the count.
+        std::size_t pop_batch(std::vector<LogRecord*>& batch, std::size_t max_count, std::chrono::milliseconds wait);
 
       private:
-        std::mutex lock;
-        std::condition_variable pending;
+        struct Lane {
+            LogRecord* head;
+            LogRecord* tail;
+            int threshold; // Largest severity for this lane
+            int weight;
+        };
 
-        LogRecord* tail;
-        LogRecord* head;
+        LogRecord* pop_lane(Lane& lane);
+        void enqueue(LogRecord* node); // Lock must be held
+        void wake();                   // Wake the worker if it is sleeping
+
+        std::mutex lock;
+        std::atomic<int>* wake_word;    // Shared with the signal handler if possible
+        std::atomic<int> own_wake_word; // Fallback if no shared word was free
+        std::atomic<bool> sleeping;
+        WorkerPool* pool; // Non-null if a WorkerPool runs the owner
+        LogWorker* owner;
+        std::vector<Lane> lanes;
+        LaneScheduling scheduling;
+        bool closed;        // See close()
+        long depth;         // Records in all lanes
+        std::size_t cursor; // WEIGHTED_PRIORITY: lane being served
+        int credit;         // WEIGHTED_PRIORITY: records left for this lane this round
     };
 
     /**
@@ -95,10 +300,59 @@ class LogWorker
      */
     void work();
 
+    /**
+     * Send a record to its channel's sink, or run it if it is a control record
+     */
+    void dispatch(LogRecord* node);
+
+    /**
+     * Dispatch the batch. Runs of records for a channel that formats in
+     * parallel go to the channel together.
+     */
+    void dispatch_batch();
+
+    /// If preserving order, sort the batch by timestamp
+    void sort_batch();
+
+    /// Sync the sinks of records with waiting producers, then wake the producers
+    void complete_syncs();
+
+    /// Write a record straight to the drain fallback descriptor, then free it
+    void dump_raw(LogRecord* node);
+
+    /// Free a record unwritten, counting it as a drop
+    void drop(LogRecord* node);
+
+    /// Run or drop everything queued or staged. Used once the worker has retired.
+    void drop_queued();
+
+    /// Publish stages that have waited too long, or (at shutdown) every stage
+    void publish_stages(bool everything);
+
+    /// Publish a stage. Its lock must be held.
+    void publish_locked(ThreadStage& stage);
+
     LogQueue record_queue;
+    std::vector<LogRecord*> batch; // Worker-owned
+    struct PendingSync {
+        int channel_id;
+        LogCompletion* completion;
+    };
+    std::vector<PendingSync> syncs; // Worker-owned
+    bool preserve_order;
+    std::mutex stage_lock;
+    std::vector<std::shared_ptr<ThreadStage>> stages;
+    long long stage_delay_ns; // Zero unless some channel batches
     // We keep a vector of channels for O(1) lookup, even if many entries may be nullptr
     std::vector<std::shared_ptr<LogChannel>> channel_list;
     std::thread worker;
+    std::atomic<bool> retired; // Set by retire()
+    ThreadPlacement thread_placement;
+
+    // WorkerPool state
+    friend class WorkerPool;
+    WorkerPool* shared_pool;
+    std::atomic<int> pool_state;
 };
 
 inline void LogWorker::push_to_queue(LogRecord* rec)
@@ -11,16 +11,24 @@
 #if SLOG_LOG_TO_CONSOLE_WHEN_STOPPED
 #include "ConsoleSink.hpp"
 #endif
+#include <algorithm>
 #include <atomic>
 #include <csignal>
 #include <cstring>
 #include <endian.h>
+#include <limits>
 #include <map>
 #include <memory>
+#include <set>
+#include <string>
+#include <thread>
 
 namespace slog
 {
 
+/// Free records below which the worker grows a default pool in the background
+constexpr long DEFAULT_POOL_LOW_WATERMARK = DEFAULT_POOL_RECORD_COUNT / 4;
+
 namespace detail
 {
 
@@ -30,6 +38,12 @@ static std::shared_ptr<LogChannel> make_channel(std::shared_ptr<LogSink> sink, T
     return std::make_shared<LogChannel>(sink, threshold, pool);
 }
 
+static std::shared_ptr<LogChannel> make_channel(std::shared_ptr<LogSink> sink, ThresholdMap const& threshold,
+                                                std::vector<std::shared_ptr<LogRecordPool>> node_pools)
+{
+    return std::make_shared<LogChannel>(sink, threshold, node_pools);
+}
+
 /// Install handlers for signals and exit. Idempotent.
 std::atomic<bool> static s_installed_signal_handlers{false};
 static bool install_slog_handlers()
@@ -49,6 +63,308 @@ static bool install_slog_handlers()
     return true;
 }
 
+// Bumped whenever the workers are torn down, which orphans every thread's stages
+static std::atomic<unsigned> s_stage_epoch{0};
+
+namespace
+{
+/// The calling thread's stages, indexed by channel
+struct ThreadStages {
+    ThreadStages()
+        : epoch(0)
+    {
+    }
+
+    ~ThreadStages() { publish(); }
+
+    void publish()
+    {
+        if (epoch != s_stage_epoch.load(std::memory_order_acquire)) {
+            return;
+        }
+        for (auto& stage : by_channel) {
+            if (stage) {
+                stage->worker->publish(*stage);
+            }
+        }
+    }
+
+    unsigned epoch;
+    std::vector<std::shared_ptr<LogWorker::ThreadStage>> by_channel;
+};
+
+thread_local ThreadStages t_stages;
+} // namespace
+
+LogWorker::ThreadStage& Logger::thread_stage(int channel)
+{
+    unsigned epoch = s_stage_epoch.load(std::memory_order_acquire);
+    if (t_stages.epoch != epoch) {
+        t_stages.by_channel.clear();
+        t_stages.epoch = epoch;
+    }
+    if (channel >= (int)t_stages.by_channel.size()) {
+        t_stages.by_channel.resize(channel + 1);
+    }
+    auto& stage = t_stages.by_channel[channel];
+    if (!stage) {
+        GracePeriod::ReadSection reading;
+        stage = channels()->worker[channel]->make_stage();
+    }
+    return *stage;
+}
+
+void Logger::flush_thread() { t_stages.publish(); }
+
+void Logger::push_and_wait(LogWorker& worker, LogRecord* record, bool batching)
+{
+    static thread_local LogCompletion t_completion;
+    int channel = record->meta().channel();
+    if (batching) {
+        worker.publish(thread_stage(channel));
+    }
+    // Once stopping, the worker either drains the record or refuses it
+    worker.push_and_wait(record, t_completion);
+}
+
+namespace
+{
+/// Flush a channel's sink, then signal the waiting thread
+class FlushAction : public LogControl
+{
+  public:
+    FlushAction(std::shared_ptr<LogChannel> channel_, std::promise<void> done_)
+        : channel(channel_),
+          done(std::move(done_))
+    {
+    }
+
+    void run() override
+    {
+        channel->flush();
+        done.set_value();
+    }
+
+  private:
+    std::shared_ptr<LogChannel> channel;
+    std::promise<void> done;
+};
+} // namespace
+
+std::future<void> Logger::flush_async(int channel)
+{
+    std::promise<void> done;
+    std::future<void> flushed = done.get_future();
+    if (get_signal_state() != SLOG_ACTIVE || channel_count() == 0) {
+        done.set_value(); // Nothing is queued
+        return flushed;
+    }
+    GracePeriod::ReadSection reading;
+    ChannelTable const* table = channels();
+    if (nullptr == table) {
+        done.set_value(); // Stopped meanwhile
+        return flushed;
+    }
+    channel = live_channel(channel);
+    flush_thread();
+    auto& worker = table->worker[channel];
+    worker->push_barrier(channel, new FlushAction(worker->get_channel(channel), std::move(done)));
+    return flushed;
+}
+
+namespace
+{
+/// Copy a channel's worker thread settings
+void place_worker(ThreadPlacement& placement, LogConfig const& con, std::string const& default_name)
+{
+    placement.cpus = con.get_worker_cpus();
+    placement.scheduling = con.get_worker_scheduling();
+    placement.nice = con.get_worker_nice();
+    placement.name = con.get_worker_name().empty() ? default_name : con.get_worker_name();
+}
+
+/// Finalize a channel's sink and swap in another
+class ReplaceSinkAction : public LogControl
+{
+  public:
+    ReplaceSinkAction(std::shared_ptr<LogChannel> channel_, std::shared_ptr<LogSink> sink_)
+        : channel(channel_),
+          sink(std::move(sink_))
+    {
+    }
+
+    void run() override { channel->replace_sink(std::move(sink)); }
+
+  private:
+    std::shared_ptr<LogChannel> channel;
+    std::shared_ptr<LogSink> sink;
+};
+
+/// Finalize a removed channel's sink. If the channel had a worker thread to
+/// itself, retire the worker too.
+class RemoveChannelAction : public LogControl
+{
+  public:
+    RemoveChannelAction(std::shared_ptr<LogChannel> channel_, LogWorker* worker_, std::promise<void> done_)
+        : channel(channel_),
+          worker(worker_),
+          done(std::move(done_))
+    {
+    }
+
+    void run() override
+    {
+        channel->replace_sink(std::make_shared<NullSink>());
+        if (worker) {
+            worker->retire();
+        }
+        done.set_value();
+    }
+
+    void discard() override { done.set_value(); }
+
+  private:
+    std::shared_ptr<LogChannel> channel;
+    LogWorker* worker;
+    std::promise<void> done;
+};
+} // namespace
+
+void Logger::update_verbosity_gate()
+{
+    std::unique_lock<std::mutex> guard(instance().table_lock);
+    ChannelTable const* table = channels();
+    if (nullptr == table) {
+        // Unknown until the next call sets up channels
+        g_verbosity_gate.store(std::numeric_limits<int>::max());
+        return;
+    }
+    int most = std::numeric_limits<int>::min();
+    for (std::size_t id = 0; id < table->worker.size(); id++) {
+        if (!table->removed[id]) {
+            most = std::max(most, table->worker[id]->get_channel((int)id)->max_threshold());
+        }
+    }
+    g_verbosity_gate.store(most);
+}
+
+void Logger::publish_table(std::unique_ptr<ChannelTable> table)
+{
+    ChannelTable const* old = channel_table.exchange(table.release(), std::memory_order_acq_rel);
+    if (old) {
+        GracePeriod::retire(old);
+    }
+}
+
+LogChannel& Logger::stopped_channel()
+{
+    static std::shared_ptr<LogChannel> s_channel = [] {
+        ThresholdMap threshold;
+        threshold.set_default(std::numeric_limits<int>::min());
+        return make_channel(std::make_shared<NullSink>(), threshold, std::make_shared<LogRecordPool>(DISCARD, 0, 0));
+    }();
+    return *s_channel;
+}
+
+int Logger::add_channel(LogConfig const& config)
+{
+    Logger& logger = instance();
+    std::unique_lock<std::mutex> guard(logger.table_lock);
+    ChannelTable const* current = channels();
+    if (get_signal_state() != SLOG_ACTIVE || nullptr == current) {
+        slog_error("Cannot add a channel while the logger is stopped\n");
+        return -1;
+    }
+    int channel_id = (int)current->worker.size();
+
+    // The new channel gets a worker of its own, as running workers can't take
+    // new channels
+    LogConfig con = config;
+    auto worker = std::make_shared<LogWorker>();
+    place_worker(worker->placement(), con, "slog-c" + std::to_string(channel_id));
+    worker->set_numa_node(con.get_worker_numa_node());
+    if (con.get_lane_scheduling() != SINGLE_LANE) {
+        worker->set_priority_lanes(con.get_lane_scheduling(), con.get_lane_thresholds(), con.get_lane_weights());
+    }
+    worker->set_preserve_order(con.get_preserve_order());
+    if (con.get_batch_records() > 1) {
+        worker->set_stage_delay(con.get_batch_delay());
+    }
+    // Share the default pools with the other channels rather than making more
+    worker->add_channel(channel_id, make_configured_channel(con, logger.default_pool, logger.default_node_pools));
+    worker->start();
+
+    std::unique_ptr<ChannelTable> table(new ChannelTable(*current));
+    table->worker.push_back(worker);
+    table->removed.push_back(false);
+    logger.publish_table(std::move(table));
+    logger.num_worker++;
+    guard.unlock();
+    update_verbosity_gate();
+    return channel_id;
+}
+
+bool Logger::remove_channel(int channel)
+{
+    Logger& logger = instance();
+    std::unique_lock<std::mutex> guard(logger.table_lock);
+    if (get_signal_state() != SLOG_ACTIVE || channel == DEFAULT_CHANNEL || live_channel(channel) != channel) {
+        return false;
+    }
+    ChannelTable const* current = channels();
+    std::shared_ptr<LogWorker> worker = current->worker[channel];
+    bool own_thread =
+        !worker->is_pooled() && std::count(current->worker.begin(), current->worker.end(), worker) == 1;
+    std::unique_ptr<ChannelTable> table(new ChannelTable(*current));
+    table->removed[channel] = true;
+    logger.publish_table(std::move(table)); // current may be freed from here on
+    guard.unlock();
+    update_verbosity_gate();
+
+    // Wait out producers still using the old table, so their records are
+    // queued ahead of the barrier and written. Later ones see the channel is
+    // removed and drop theirs, as does the worker for records staged by
+    // batching threads that reach it after the barrier.
+    GracePeriod::synchronize();
+    std::promise<void> removed;
+    std::future<void> done = removed.get_future();
+    worker->push_barrier(channel,
+                         new RemoveChannelAction(worker->get_channel(channel), own_thread ? worker.get() : nullptr,
+                                                 std::move(removed)));
+    if (own_thread) {
+        done.wait();
+        worker->join();
+    }
+    return true;
+}
+
+bool Logger::set_sink(int channel, std::shared_ptr<LogSink> sink)
+{
+    Logger& logger = instance();
+    std::unique_lock<std::mutex> guard(logger.table_lock);
+    if (get_signal_state() != SLOG_ACTIVE || live_channel(channel) != channel) {
+        return false;
+    }
+    if (!sink) {
+        sink = std::make_shared<NullSink>();
+    }
+    auto& worker = channels()->worker[channel];
+    worker->push_barrier(channel, new ReplaceSinkAction(worker->get_channel(channel), std::move(sink)));
+    return true;
+}
+
+int Logger::event_fd()
+{
+    auto& pool = instance().external_pool;
+    return pool ? pool->event_fd() : -1;
+}
+
+std::size_t Logger::drain(std::size_t max_records, std::chrono::steady_clock::time_point deadline)
+{
+    auto& pool = instance().external_pool;
+    return pool ? pool->run(max_records, deadline) : 0;
+}
+
 Logger& Logger::instance()
 {
     static Logger s_logger;
@@ -56,15 +372,80 @@ Logger& Logger::instance()
 }
 
 Logger::Logger()
-: num_worker(0)
+: num_worker(0),
+  channel_table(nullptr)
 {
     // setup_initial_channel();
 }
 
 std::shared_ptr<LogRecordPool> Logger::make_default_pool()
 {
-    return std::make_shared<LogRecordPool>(
+    auto pool = std::make_shared<LogRecordPool>(
         ALLOCATE, DEFAULT_POOL_RECORD_COUNT * (DEFAULT_RECORD_SIZE + sizeof(LogRecord)), DEFAULT_RECORD_SIZE);
+    pool->set_low_watermark(DEFAULT_POOL_LOW_WATERMARK);
+    return pool;
+}
+
+std::vector<std::shared_ptr<LogRecordPool>> Logger::make_numa_pools()
+{
+    // Memory is placed on the node of the thread that first touches it, so
+    // build (and prefault) each pool on a thread bound to its node. Pools are
+    // indexed by the node's place in numa_nodes(), as node ids can have gaps.
+    std::vector<std::shared_ptr<LogRecordPool>> pools(numa_node_count());
+    for (int index = 0; index < (int)pools.size(); index++) {
+        std::thread builder([index, &pools]() {
+            bind_thread_to_numa_node(numa_nodes()[index]);
+            pools[index] = std::make_shared<LogRecordPool>(
+                ALLOCATE, DEFAULT_POOL_RECORD_COUNT * (DEFAULT_RECORD_SIZE + sizeof(LogRecord)),
+                DEFAULT_RECORD_SIZE, 50, MAPPED_MEMORY | PREFAULT);
+            pools[index]->set_low_watermark(DEFAULT_POOL_LOW_WATERMARK);
+        });
+        builder.join();
+    }
+    return pools;
+}
+
+std::shared_ptr<LogChannel> Logger::make_configured_channel(LogConfig& con,
+                                                            std::shared_ptr<LogRecordPool>& default_pool,
+                                                            std::vector<std::shared_ptr<LogRecordPool>>& default_node_pools)
+{
+    std::shared_ptr<LogSink> sink = con.get_sink();
+    if (!sink) {
+        sink = std::make_shared<NullSink>();
+    }
+
+    std::shared_ptr<LogChannel> channel;
+    if (con.get_numa_pools()) {
+        std::vector<std::shared_ptr<LogRecordPool>> node_pools = con.get_node_pools();
+        if (node_pools.empty()) {
+            if (default_node_pools.empty()) {
+                default_node_pools = make_numa_pools();
+            }
+            node_pools = default_node_pools;
+        }
+        channel = make_channel(sink, con.get_threshold_map(), node_pools);
+    } else {
+        std::shared_ptr<LogRecordPool> pool = con.get_pool();
+        if (!pool) {
+            if (!default_pool) {
+                default_pool = make_default_pool();
+            }
+            pool = default_pool;
+        }
+        channel = make_channel(sink, con.get_threshold_map(), pool);
+    }
+    channel->set_sync_severity(con.get_sync_severity());
+    channel->set_format_threads(con.get_format_threads());
+    if (con.get_duplicate_coalescing()) {
+        channel->set_duplicate_coalescing(con.get_duplicate_delay());
+    }
+    if (con.get_shed_high_water() > 0) {
+        channel->set_load_shedding(con.get_shed_high_water(), con.get_shed_low_water(), con.get_shed_interval());
+    }
+    if (con.get_batch_records() > 1) {
+        channel->set_thread_batching(con.get_batch_records(), con.get_batch_immediate_severity());
+    }
+    return channel;
 }
 
 void Logger::setup_channels(std::vector<LogConfig>& config)
@@ -74,39 +455,83 @@ void Logger::setup_channels(std::vector<LogConfig>& config)
         return;
     }
 
-    std::shared_ptr<LogRecordPool> default_pool;
-    auto null_sink = std::make_shared<NullSink>();
+    auto& default_pool = instance().default_pool;
+    auto& default_node_pools = instance().default_node_pools;
 
     // Determine the number of workers
     std::map<int, std::shared_ptr<LogWorker>> worker;
-    auto& channel_worker = instance().channel_worker;
-    channel_worker.resize(config.size());
+    std::set<int> pinned_workers;
+    std::set<int> laned_workers;
+    std::vector<std::pair<WorkerPool*, std::shared_ptr<LogWorker>>> pooled_workers;
+    auto& worker_pool = instance().worker_pool;
+    auto& external_pool = instance().external_pool;
+    std::unique_ptr<ChannelTable> table(new ChannelTable);
+    table->worker.resize(config.size());
+    table->removed.assign(config.size(), false);
     for (std::size_t channelId = 0; channelId < config.size(); channelId++) {
         auto& con = config[channelId];
 
-        if (worker.count(con.get_worker_thread_id()) == 0) {
-            worker[con.get_worker_thread_id()] = std::make_shared<LogWorker>();
+        // Pooled channels each get a thread-less worker of their own. The
+        // application runs the pool of externally drained channels.
+        bool external = con.get_external_drain();
+        bool pooled = external || con.get_worker_pool() > 0;
+        std::shared_ptr<LogWorker> this_worker;
+        if (external) {
+            if (!external_pool) {
+                external_pool = std::make_shared<WorkerPool>(0);
+            }
+            this_worker = std::make_shared<LogWorker>();
+            this_worker->set_pool(external_pool.get());
+            pooled_workers.emplace_back(external_pool.get(), this_worker);
+        } else if (pooled) {
+            if (!worker_pool) {
+                worker_pool = std::make_shared<WorkerPool>(con.get_worker_pool());
+                place_worker(worker_pool->placement(), con, "slog-pool");
+            }
+            worker_pool->set_thread_count(con.get_worker_pool());
+            this_worker = std::make_shared<LogWorker>();
+            this_worker->set_pool(worker_pool.get());
+            pooled_workers.emplace_back(worker_pool.get(), this_worker);
+        } else {
+            if (worker.count(con.get_worker_thread_id()) == 0) {
+                worker[con.get_worker_thread_id()] = std::make_shared<LogWorker>();
+                place_worker(worker[con.get_worker_thread_id()]->placement(), con,
+                             "slog-" + std::to_string(con.get_worker_thread_id()));
+            }
+            this_worker = worker[con.get_worker_thread_id()];
         }
-        std::shared_ptr<LogWorker> this_worker = worker[con.get_worker_thread_id()];
-
-        std::shared_ptr<LogRecordPool> pool = con.get_pool();
-        if (!pool) {
-            if (!default_pool) {
-                 default_pool = make_default_pool();
+        if (!pooled && con.get_worker_numa_node() >= 0 && pinned_workers.count(con.get_worker_thread_id()) == 0) {
+            pinned_workers.insert(con.get_worker_thread_id());
+            this_worker->set_numa_node(con.get_worker_numa_node());
+        }
+        if (con.get_lane_scheduling() != SINGLE_LANE &&
+            (pooled || laned_workers.count(con.get_worker_thread_id()) == 0)) {
+            if (!pooled) {
+                laned_workers.insert(con.get_worker_thread_id());
             }
-            pool = default_pool;
+            this_worker->set_priority_lanes(con.get_lane_scheduling(), con.get_lane_thresholds(),
+                                            con.get_lane_weights());
         }
-
-        std::shared_ptr<LogSink> sink = con.get_sink();
-        if (!sink) {
-            sink = null_sink;
+        if (con.get_preserve_order()) {
+            this_worker->set_preserve_order(true);
+        }
+        if (con.get_batch_records() > 1) {
+            this_worker->set_stage_delay(con.get_batch_delay());
         }
 
-        auto channel = make_channel(sink, con.get_threshold_map(), pool);
+        std::shared_ptr<LogChannel> channel = make_configured_channel(con, default_pool, default_node_pools);
         this_worker->add_channel(channelId, channel);
-        channel_worker[channelId] = this_worker;
+        table->worker[channelId] = this_worker;
     }
-    instance().num_worker = (int) worker.size();
+    for (auto& pooled_worker : pooled_workers) {
+        pooled_worker.first->add_worker(pooled_worker.second);
+    }
+    instance().num_worker = (int) worker.size() + (worker_pool ? worker_pool->thread_count() : 0);
+    {
+        std::unique_lock<std::mutex> guard(instance().table_lock);
+        instance().publish_table(std::move(table));
+    }
+    update_verbosity_gate();
 }
 
 void Logger::start()
@@ -114,17 +539,45 @@ void Logger::start()
     install_slog_handlers();
     reset_worker_counts();
     set_signal_state(SLOG_ACTIVE);
-    for (auto& worker : instance().channel_worker) {
+    for (auto& worker : channels()->worker) {
         if (worker) {
             worker->start();
         }
     }
+    if (instance().worker_pool) {
+        instance().worker_pool->start();
+    }
+    if (instance().external_pool) {
+        instance().external_pool->start();
+    }
 }
 
 void Logger::stop()
 {
     set_signal_state(SLOG_STOPPED);
-    instance().channel_worker.clear();
+    s_stage_epoch.fetch_add(1, std::memory_order_acq_rel);
+    // The pool drains its workers, so stop it before they are destroyed. Keep
+    // it until they are, as their queues still point at it.
+    if (instance().worker_pool) {
+        instance().worker_pool->stop();
+    }
+    if (instance().external_pool) {
+        instance().external_pool->stop();
+    }
+    ChannelTable const* last;
+    {
+        std::unique_lock<std::mutex> guard(instance().table_lock);
+        last = instance().channel_table.exchange(nullptr);
+    }
+    // Producers may still be reading the table, so wait them out before
+    // destroying the workers
+    GracePeriod::synchronize();
+    delete last;
+    update_verbosity_gate();
+    instance().worker_pool.reset();
+    instance().external_pool.reset();
+    instance().default_pool.reset();
+    instance().default_node_pools.clear();
     restore_old_signal_handlers();
     s_installed_signal_handlers = false;
     instance().num_worker = 0;
@@ -146,8 +599,15 @@ void Logger::setup_default_channel()
     pool = std::make_shared<LogRecordPool>(DISCARD, 0, 0);
     sink = std::make_shared<NullSink>();
 #endif
-    channel_worker.emplace_back(std::make_shared<LogWorker>());
-    channel_worker.back()->add_channel(DEFAULT_CHANNEL, make_channel(sink, threshold, pool));
+    std::unique_ptr<ChannelTable> table(new ChannelTable);
+    table->worker.emplace_back(std::make_shared<LogWorker>());
+    table->worker.back()->add_channel(DEFAULT_CHANNEL, make_channel(sink, threshold, pool));
+    table->removed.push_back(false);
+    {
+        std::unique_lock<std::mutex> guard(table_lock);
+        publish_table(std::move(table));
+    }
+    update_verbosity_gate();
     num_worker = 1;
     start();
 }
@@ -169,7 +629,8 @@ int Logger::worker_count()
 
 int Logger::channel_count() 
 { 
-    return (int) instance().channel_worker.size();    
+    ChannelTable const* table = channels();
+    return table ? (int)table->worker.size() : 0;    
 }
 
 
@@ -1,16 +1,31 @@
 #pragma once
+#include "GracePeriod.hpp"
 #include "LogChannel.hpp"
 #include "LogRecordPool.hpp"
 #include "LogSetup.hpp"
 #include "LogWorker.hpp"
+#include "WorkerPool.hpp"
 #include "slog/LogRecord.hpp"
+#include <chrono>
+#include <future>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 namespace slog
 {
 namespace detail
 {
+/**
+ * @brief Maps channel ids to workers. A table is never changed once published,
+ * so producers read it without locks; changes publish a new table.
+ */
+struct ChannelTable {
+    std::vector<std::shared_ptr<LogWorker>> worker; // Indexed by channel id
+    std::vector<bool> removed;                      // Records for these go to DEFAULT_CHANNEL
+};
+
 /**
  * @brief The Logger singleton manages logger channels, record pools, and
  * signals.
@@ -44,11 +59,65 @@ class Logger
      */
     static LogChannel& get_channel(int channel);
 
+    /**
+     * @brief Map channel to the channel its records go to: itself if it is
+     * live, otherwise DEFAULT_CHANNEL
+     */
+    static int live_channel(int channel);
+
+    /**
+     * @brief Add a channel to the running logger. Returns its id, or -1 if
+     * the logger is not running.
+     */
+    static int add_channel(LogConfig const& config);
+
+    /**
+     * @brief Send a channel's future records to DEFAULT_CHANNEL, then finalize
+     * its sink once the records already queued are written. A worker thread
+     * serving only this channel is then stopped. Returns false if the channel
+     * is not live or is DEFAULT_CHANNEL.
+     */
+    static bool remove_channel(int channel);
+
+    /**
+     * @brief Swap the sink of a live channel once the records already queued
+     * are written to the old sink, which is then finalized. Returns false if
+     * the channel is not live.
+     */
+    static bool set_sink(int channel, std::shared_ptr<LogSink> sink);
+
+    /**
+     * @brief Recompute g_verbosity_gate after thresholds or channels change
+     */
+    static void update_verbosity_gate();
+
     /**
      * Push a record to the backend
      */
     static void push_to_sink(LogRecord* record);
 
+    /**
+     * Publish the calling thread's staged records on every channel
+     */
+    static void flush_thread();
+
+    /**
+     * Get a future that is ready once everything queued on channel before the
+     * call has reached the sink and the sink has been flushed
+     */
+    static std::future<void> flush_async(int channel);
+
+    /**
+     * Descriptor that is readable while channels drained by the application
+     * have records to write (-1 if there are no such channels)
+     */
+    static int event_fd();
+
+    /**
+     * Write records from channels drained by the application. See slog::drain().
+     */
+    static std::size_t drain(std::size_t max_records, std::chrono::steady_clock::time_point deadline);
+
     /**
      * Internal log start function.
      */
@@ -66,13 +135,50 @@ class Logger
 
     void setup_default_channel();
 
+    /// A channel that discards everything, for callers that race stop()
+    static LogChannel& stopped_channel();
+
+    /// Find (or make) the calling thread's stage for a channel
+    static LogWorker::ThreadStage& thread_stage(int channel);
+
+    /// Push a record and wait for the worker to sync it
+    static void push_and_wait(LogWorker& worker, LogRecord* record, bool batching);
+
     static std::shared_ptr<LogRecordPool> make_default_pool();
 
+    /// Make one default pool per NUMA node, with memory local to that node
+    static std::vector<std::shared_ptr<LogRecordPool>> make_numa_pools();
+
+    /// The current channel table (null if there are no channels). Hold a
+    /// GracePeriod::ReadSection while using it.
+    static ChannelTable const* channels() { return instance().channel_table.load(std::memory_order_acquire); }
+
+    /// Make table current, retiring the old one. Call with table_lock held.
+    void publish_table(std::unique_ptr<ChannelTable> table);
+
+    /// Make a channel from its config. Channels without their own pools share the default ones.
+    static std::shared_ptr<LogChannel> make_configured_channel(
+        LogConfig& con, std::shared_ptr<LogRecordPool>& default_pool,
+        std::vector<std::shared_ptr<LogRecordPool>>& default_node_pools);
+
     /// nominal number of workers
-    int num_worker;
+    std::atomic<int> num_worker;
+
+    /// Lists the worker for each channel id. Replaced tables are freed once no
+    /// producer can still be reading them (see GracePeriod).
+    std::atomic<ChannelTable const*> channel_table;
+    std::mutex table_lock;
+
+    /// Runs the workers of pooled channels (null if no channel is pooled)
+    std::shared_ptr<WorkerPool> worker_pool;
 
-    /// Lists the worker for each channel id
-    std::vector<std::shared_ptr<LogWorker>> channel_worker;
+    /// Pool run by the application for its channels (null if there are none)
+    std::shared_ptr<WorkerPool> external_pool;
+
+    /// Record pools shared by channels without their own, made on first use.
+    /// add_channel() reuses these. Guarded by table_lock once running.
+    std::shared_ptr<LogRecordPool> default_pool;
+    std::vector<std::shared_ptr<LogRecordPool>> default_node_pools;
 };
 
 /// (For debugging the logger) Check that all pool records are either free or in
@@ -81,20 +187,77 @@ long get_pool_missing_count();
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////
 
+inline int Logger::live_channel(int channel)
+{
+    GracePeriod::ReadSection reading;
+    ChannelTable const* table = channels();
+    if (nullptr == table || channel < 0 || channel >= (int)table->worker.size() || table->removed[channel]) {
+        return DEFAULT_CHANNEL;
+    }
+    return channel;
+}
+
 inline LogChannel& Logger::get_channel(int channel)
 {
-    if (channel_count() == 0) {
+    GracePeriod::ReadSection reading;
+    ChannelTable const* table = channels();
+    if (nullptr == table) {
         instance().setup_default_channel();
+        table = channels();
+        if (nullptr == table) {
+            return stopped_channel(); // Stopped again meanwhile
+        }
     }
-    if (channel < 0 || channel >= channel_count()) {
-        channel = DEFAULT_CHANNEL;
-    }
-    return *instance().channel_worker[channel]->get_channel(channel);
+    channel = live_channel(channel);
+    return *table->worker[channel]->get_channel(channel);
 }
 
 inline void Logger::push_to_sink(LogRecord* record)
 {
-    instance().channel_worker[record->meta().channel()]->push_to_queue(record);
+    GracePeriod::ReadSection reading;
+    ChannelTable const* table = channels();
+    if (nullptr == table) {
+        // The logger stopped after the record was filled in. Its pool went
+        // (or is going) with the channels, so the record is dropped.
+        return;
+    }
+    int channel = record->meta().channel();
+    auto& worker = table->worker[channel];
+    LogChannel& log_channel = *worker->get_channel(channel);
+    if (table->removed[channel]) {
+        // The record raced remove_channel(), which may have stopped the worker
+        int severity = record->meta().severity();
+        log_channel.count_drop(severity);
+        log_channel.dispose_of_record(record);
+        if (severity == FATL) {
+            std::abort();
+        }
+        return;
+    }
+    bool batching = log_channel.get_batch_records() > 1;
+    if (LogChannel::needs_spill(record)) {
+        if (batching) {
+            // Staged records were logged before this one
+            worker->publish(thread_stage(channel));
+        }
+        int severity = record->meta().severity();
+        LogControl* replay = log_channel.spill(record);
+        if (replay) {
+            worker->push_barrier(channel, replay);
+        }
+        if (severity == FATL) {
+            std::abort();
+        }
+        return;
+    } else if (record->meta().severity() <= log_channel.get_sync_severity()) {
+        push_and_wait(*worker, record, batching);
+        return;
+    } else if (batching) {
+        worker->stage(thread_stage(channel), record, log_channel.get_batch_records(),
+                      log_channel.get_batch_immediate_severity());
+        return;
+    }
+    worker->push_to_queue(record);
 }
 
 } // namespace detail
@@ -1,5 +1,8 @@
 #pragma once
+#include <atomic>
+#include <cstddef>
 #include <ctime>
+#include <vector>
 
 namespace slog
 {
@@ -22,6 +25,160 @@ void zulu_time_r(struct tm* o_datetime, time_t const* seconds_since_epoch);
  */
 bool make_directory(char const* directory, int mode = 509);
 
+/**
+ * @brief Map anonymous, private memory.
+ *
+ * The size is rounded up to a whole number of pages (or huge pages if
+ * huge_pages is set) and the rounded size is written back to io_size. If huge
+ * pages are requested but none are reserved, this falls back to normal pages
+ * and advises the kernel to use transparent huge pages instead. If populate is
+ * set, the pages are faulted in before returning. Returns nullptr on failure.
+ */
+void* map_memory(std::size_t* io_size, bool huge_pages, bool populate);
+
+/**
+ * @brief Release memory obtained from map_memory()
+ */
+void unmap_memory(void* memory, std::size_t size);
+
+/**
+ * @brief Lock the pages of [memory, memory + size) into RAM so they are never
+ * paged out. Returns false (with a diagnostic) if the lock fails, typically
+ * because RLIMIT_MEMLOCK is too small.
+ */
+bool lock_memory(void const* memory, std::size_t size);
+
+/**
+ * @brief Write to every page in [memory, memory + size) so that the page faults
+ * happen now rather than later.
+ */
+void prefault_memory(void* memory, std::size_t size);
+
+/**
+ * @brief Number of online NUMA nodes on this machine, read from sysfs.
+ * Machines without NUMA support report one node.
+ */
+int numa_node_count();
+
+/**
+ * @brief The ids of the online NUMA nodes, ascending. There are
+ * numa_node_count() of them, but the ids may have gaps.
+ */
+std::vector<int> const& numa_nodes();
+
+/**
+ * @brief The NUMA node of the CPU the calling thread is running on right now.
+ * This is cheap enough to call on every log record.
+ */
+int current_numa_node();
+
+/**
+ * @brief The index in numa_nodes() of current_numa_node(). Unlike node ids,
+ * indices have no gaps, so they can index per-node tables.
+ */
+int current_numa_node_index();
+
+/**
+ * @brief Restrict the calling thread to the CPUs of the given NUMA node.
+ * Returns false if the node is unknown or the affinity could not be set.
+ */
+bool bind_thread_to_numa_node(int node);
+
+enum WorkerScheduling : int;
+
+/**
+ * @brief Restrict the calling thread to the listed CPUs. Returns false if the
+ * affinity could not be set.
+ */
+bool bind_thread_to_cpus(std::vector<int> const& cpus);
+
+/**
+ * @brief Set the scheduling class of the calling thread, and its nice value if
+ * nice is not zero. Returns false if either could not be set.
+ */
+bool set_thread_scheduling(WorkerScheduling scheduling, int nice);
+
+/**
+ * @brief Name the calling thread. Names longer than 15 characters are cut.
+ */
+void set_thread_name(char const* name);
+
+/**
+ * @brief Create an anonymous temporary file in directory (or the system
+ * temporary directory if directory is empty). The file has no name and
+ * disappears when closed. Returns a file descriptor, or -1 on failure.
+ */
+int open_temporary_file(char const* directory);
+
+/**
+ * @brief Append all count bytes to the file, retrying short writes. Returns
+ * false on failure.
+ */
+bool append_to_file(int fd, void const* bytes, std::size_t count);
+
+/**
+ * @brief Read up to count bytes from the file starting at offset. Returns the
+ * number of bytes read, or -1 on failure.
+ */
+long read_from_file(int fd, void* bytes, std::size_t count, long offset);
+
+/**
+ * @brief Discard the contents of a file, leaving it empty
+ */
+void truncate_file(int fd);
+
+/**
+ * @brief Write the file's data to the storage device (fdatasync). Returns false
+ * on failure.
+ */
+bool sync_file_data(int fd);
+
+/**
+ * @brief Create a nonblocking event file descriptor (eventfd) for
+ * post_event_fd(). Returns -1 on failure.
+ */
+int open_event_fd();
+
+/**
+ * @brief Make an event descriptor readable. Async-signal-safe.
+ */
+void post_event_fd(int fd);
+
+/**
+ * @brief Make an event descriptor unreadable until the next post_event_fd()
+ */
+void clear_event_fd(int fd);
+
+/**
+ * @brief Sleep until word no longer holds expected, futex_wake() is called on
+ * it, or timeout_ns passes (negative waits forever). May return early.
+ * Async-signal-safe.
+ */
+void futex_wait(std::atomic<int>& word, int expected, long long timeout_ns);
+
+/**
+ * @brief Wake up to count threads sleeping in futex_wait() on word.
+ * Async-signal-safe.
+ */
+void futex_wake(std::atomic<int>& word, int count);
+
+/**
+ * @brief Prepare for process_barrier(). Returns false if the kernel can't
+ * provide it, in which case callers must fence on both sides themselves.
+ */
+bool enable_process_barrier();
+
+/**
+ * @brief Run a full memory barrier on every running thread of this process
+ * (Linux membarrier()). Only call this if enable_process_barrier() succeeded.
+ */
+void process_barrier();
+
+/**
+ * @brief Close a file descriptor
+ */
+void close_file(int fd);
+
 typedef void (*signal_handler)(int);
 
 /**
@@ -1,15 +1,29 @@
 #include "PlatformUtilities.hpp"
+#include "LogSetup.hpp"
 #include "Signal.hpp"
 #include "SlogError.hpp"
+#include <algorithm>
 #include <cerrno>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
 #include <linux/limits.h>
+#include <linux/membarrier.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include <string>
+#include <vector>
 
 namespace slog
 {
@@ -49,6 +63,408 @@ bool make_directory(char const* directory, int mode)
     return true;
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Memory
+namespace
+{
+// Default x86_64/aarch64 huge page size. Only used for rounding, so being
+// larger than the true size is harmless.
+constexpr std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+std::size_t page_size()
+{
+    long size = sysconf(_SC_PAGESIZE);
+    return size > 0 ? static_cast<std::size_t>(size) : 4096;
+}
+
+std::size_t round_up(std::size_t size, std::size_t granularity)
+{
+    return ((size + granularity - 1) / granularity) * granularity;
+}
+} // namespace
+
+void* map_memory(std::size_t* io_size, bool huge_pages, bool populate)
+{
+    int const flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_HUGETLB
+    if (huge_pages) {
+        std::size_t size = round_up(*io_size, HUGE_PAGE_SIZE);
+        int huge_flags = flags | MAP_HUGETLB;
+#ifdef MAP_POPULATE
+        huge_flags |= (populate ? MAP_POPULATE : 0);
+#endif
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, huge_flags, -1, 0);
+        if (memory != MAP_FAILED) {
+            *io_size = size;
+            return memory;
+        }
+    }
+#endif
+    std::size_t size = round_up(*io_size, huge_pages ? HUGE_PAGE_SIZE : page_size());
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (memory == MAP_FAILED) {
+        slog_error("Could not map %zu bytes for the record pool -- %s\n", size, strerror(errno));
+        return nullptr;
+    }
+#ifdef MADV_HUGEPAGE
+    if (huge_pages) {
+        // No reserved huge pages, so ask for transparent huge pages instead.
+        // This must happen before the pages are touched.
+        madvise(memory, size, MADV_HUGEPAGE);
+    }
+#endif
+    if (populate) {
+        prefault_memory(memory, size);
+    }
+    *io_size = size;
+    return memory;
+}
+
+void unmap_memory(void* memory, std::size_t size)
+{
+    if (memory) {
+        munmap(memory, size);
+    }
+}
+
+bool lock_memory(void const* memory, std::size_t size)
+{
+    if (0 != mlock(memory, size)) {
+        slog_error("Could not lock %zu bytes of record pool memory -- %s\n", size, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void prefault_memory(void* memory, std::size_t size)
+{
+    // Touch one byte per page. The volatile keeps the compiler from eliding
+    // the writes.
+    std::size_t const stride = page_size();
+    volatile char* cursor = static_cast<volatile char*>(memory);
+    for (std::size_t offset = 0; offset < size; offset += stride) {
+        cursor[offset] = cursor[offset];
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NUMA topology
+namespace
+{
+
+/// Parse a sysfs list like "0-3,8,10-11" into its members
+std::vector<int> parse_sysfs_list(char const* path)
+{
+    std::vector<int> members;
+    FILE* f = fopen(path, "r");
+    if (nullptr == f) {
+        return members;
+    }
+    char text[4096];
+    if (fgets(text, sizeof(text), f)) {
+        char* cursor = text;
+        while (*cursor && *cursor != '\n') {
+            char* end = nullptr;
+            long first = strtol(cursor, &end, 10);
+            if (end == cursor) {
+                break;
+            }
+            long last = first;
+            cursor = end;
+            if (*cursor == '-') {
+                last = strtol(cursor + 1, &end, 10);
+                cursor = end;
+            }
+            for (long i = first; i <= last; i++) {
+                members.push_back(static_cast<int>(i));
+            }
+            if (*cursor == ',') {
+                cursor++;
+            }
+        }
+    }
+    fclose(f);
+    return members;
+}
+
+/// CPU and node layout, read once from /sys/devices/system/node
+struct NumaTopology {
+    NumaTopology()
+    {
+        // Node ids can have gaps (e.g. after hot-unplug), so nodes are also
+        // numbered densely by their index in node_ids
+        node_ids = parse_sysfs_list("/sys/devices/system/node/online");
+        std::sort(node_ids.begin(), node_ids.end());
+        node_ids.erase(std::unique(node_ids.begin(), node_ids.end()), node_ids.end());
+        if (node_ids.empty()) {
+            node_ids.push_back(0);
+        }
+        node_cpus.resize(node_ids.back() + 1);
+        for (int index = 0; index < (int)node_ids.size(); index++) {
+            int node = node_ids[index];
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            node_cpus[node] = parse_sysfs_list(path);
+            for (int cpu : node_cpus[node]) {
+                if (cpu >= (int)cpu_node.size()) {
+                    cpu_node.resize(cpu + 1, node_ids.front());
+                    cpu_index.resize(cpu + 1, 0);
+                }
+                cpu_node[cpu] = node;
+                cpu_index[cpu] = index;
+            }
+        }
+    }
+
+    std::vector<int> node_ids;               // Online nodes, ascending
+    std::vector<std::vector<int>> node_cpus; // Indexed by node
+    std::vector<int> cpu_node;               // Indexed by cpu
+    std::vector<int> cpu_index;              // Index in node_ids, by cpu
+};
+
+NumaTopology const& numa_topology()
+{
+    static NumaTopology const s_topology;
+    return s_topology;
+}
+
+} // namespace
+
+int numa_node_count() { return (int)numa_topology().node_ids.size(); }
+
+std::vector<int> const& numa_nodes() { return numa_topology().node_ids; }
+
+int current_numa_node()
+{
+    NumaTopology const& topology = numa_topology();
+    int cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= (int)topology.cpu_node.size()) {
+        return topology.node_ids.front();
+    }
+    return topology.cpu_node[cpu];
+}
+
+int current_numa_node_index()
+{
+    NumaTopology const& topology = numa_topology();
+    int cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= (int)topology.cpu_index.size()) {
+        return 0;
+    }
+    return topology.cpu_index[cpu];
+}
+
+bool bind_thread_to_numa_node(int node)
+{
+    NumaTopology const& topology = numa_topology();
+    if (node < 0 || node >= (int)topology.node_cpus.size() || topology.node_cpus[node].empty()) {
+        slog_error("Cannot bind to unknown NUMA node %d\n", node);
+        return false;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : topology.node_cpus[node]) {
+        CPU_SET(cpu, &cpus);
+    }
+    int status = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (status != 0) {
+        slog_error("Could not bind thread to NUMA node %d -- %s\n", node, strerror(status));
+        return false;
+    }
+    return true;
+}
+
+bool bind_thread_to_cpus(std::vector<int> const& cpus)
+{
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : cpus) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            slog_error("Cannot bind to CPU %d\n", cpu);
+            return false;
+        }
+        CPU_SET(cpu, &cpu_set);
+    }
+    int status = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    if (status != 0) {
+        slog_error("Could not bind thread to CPUs -- %s\n", strerror(status));
+        return false;
+    }
+    return true;
+}
+
+bool set_thread_scheduling(WorkerScheduling scheduling, int nice)
+{
+    int policy = SCHED_OTHER;
+    if (scheduling == BATCH_SCHEDULING) {
+        policy = SCHED_BATCH;
+    } else if (scheduling == IDLE_SCHEDULING) {
+        policy = SCHED_IDLE;
+    }
+    bool ok = true;
+    sched_param param;
+    param.sched_priority = 0;
+    int status = pthread_setschedparam(pthread_self(), policy, &param);
+    if (status != 0) {
+        slog_error("Could not set thread scheduling -- %s\n", strerror(status));
+        ok = false;
+    }
+    // On Linux, the nice value belongs to the thread
+    if (nice != 0 && setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) != 0) {
+        slog_error("Could not set thread nice value to %d -- %s\n", nice, strerror(errno));
+        ok = false;
+    }
+    return ok;
+}
+
+void set_thread_name(char const* name)
+{
+    char short_name[16];
+    strncpy(short_name, name, sizeof(short_name) - 1);
+    short_name[sizeof(short_name) - 1] = '\0';
+    pthread_setname_np(pthread_self(), short_name);
+}
+
+int open_event_fd()
+{
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        slog_error("Could not create event descriptor -- %s\n", strerror(errno));
+    }
+    return fd;
+}
+
+void post_event_fd(int fd)
+{
+    uint64_t one = 1;
+    while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+}
+
+void clear_event_fd(int fd)
+{
+    uint64_t count;
+    while (read(fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+    }
+}
+
+int open_temporary_file(char const* directory)
+{
+    std::string path(directory ? directory : "");
+    if (path.empty()) {
+        char const* tmpdir = getenv("TMPDIR");
+        path = (tmpdir && tmpdir[0]) ? tmpdir : "/tmp";
+    }
+    int fd = -1;
+#ifdef O_TMPFILE
+    fd = open(path.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+        return fd;
+    }
+#endif
+    // Fall back to a named file that is unlinked immediately
+    path += "/slog-XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    fd = mkstemp(name.data());
+    if (fd < 0) {
+        slog_error("Could not create a temporary file in %s -- %s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+    unlink(name.data());
+    return fd;
+}
+
+bool append_to_file(int fd, void const* bytes, std::size_t count)
+{
+    char const* cursor = static_cast<char const*>(bytes);
+    while (count > 0) {
+        ssize_t written = write(fd, cursor, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        cursor += written;
+        count -= written;
+    }
+    return true;
+}
+
+long read_from_file(int fd, void* bytes, std::size_t count, long offset)
+{
+    char* cursor = static_cast<char*>(bytes);
+    long total = 0;
+    while (count > 0) {
+        ssize_t got = pread(fd, cursor, count, offset + total);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        cursor += got;
+        count -= got;
+        total += got;
+    }
+    return total;
+}
+
+void truncate_file(int fd)
+{
+    if (0 != ftruncate(fd, 0)) {
+        slog_error("Could not truncate file -- %s\n", strerror(errno));
+    }
+    lseek(fd, 0, SEEK_SET);
+}
+
+bool sync_file_data(int fd)
+{
+    while (0 != fdatasync(fd)) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex words must be plain ints");
+
+void futex_wait(std::atomic<int>& word, int expected, long long timeout_ns)
+{
+    struct timespec timeout;
+    struct timespec* timeout_ptr = nullptr;
+    if (timeout_ns >= 0) {
+        timeout.tv_sec = timeout_ns / 1000000000LL;
+        timeout.tv_nsec = timeout_ns % 1000000000LL;
+        timeout_ptr = &timeout;
+    }
+    syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAIT_PRIVATE, expected, timeout_ptr, nullptr, 0);
+}
+
+void futex_wake(std::atomic<int>& word, int count)
+{
+    syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+bool enable_process_barrier()
+{
+    return 0 == syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0);
+}
+
+void process_barrier() { syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0); }
+
+void close_file(int fd)
+{
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////
 // Signal handling
 namespace
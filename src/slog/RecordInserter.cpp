@@ -14,7 +14,9 @@ RecordInserter::RecordInserter(LogRecord* i_node)
       cursor(nullptr),
       buffer_end(nullptr)
 {
-    set_node(i_node);
+    if (i_node) {
+        set_node(i_node);
+    }
 }
 
 RecordInserter::~RecordInserter()
@@ -49,7 +51,8 @@ long RecordInserter::write(void const* bytes, long byte_count)
 {
     long count = write_some(reinterpret_cast<char const*>(bytes), byte_count);
     while (count < byte_count) {
-        LogRecord* extra = get_fresh_record(head_node->meta().channel(), nullptr, nullptr, -1, ~0, nullptr);
+        LogRecord* extra = get_fresh_record(head_node->meta().channel(), nullptr, nullptr, -1,
+                                            head_node->meta().severity(), nullptr);
         if (nullptr == extra) {
             return count;
         }
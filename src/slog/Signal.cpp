@@ -1,10 +1,12 @@
 #include "Signal.hpp"
-#include <thread>
 #include "PlatformUtilities.hpp"
 #include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
+#include <climits>
 #include <csignal>
+#include <unistd.h>
 
 namespace slog
 {
@@ -15,30 +17,109 @@ std::array<int, 3> const HANDLED_SIGNALS = {SIGINT, SIGTERM, SIGABRT};
 /// Track the signal being handled
 std::atomic_int static g_signal_state{SLOG_STOPPED};
 
-/// Count the workers that have reported being finished
+/// Count the workers that have reported being finished. This is also a futex
+/// word for block_until_all_workers_done().
 std::atomic_int static g_worker_stopped{0};
 
 /// Count the workers that have reported starting
 std::atomic_int static g_worker_started{0};
 
+/// Futex words for waking sleeping workers. Static, so a signal handler never
+/// sees one disappear.
+constexpr int WAKE_WORD_COUNT = 64;
+std::atomic_int static g_wake_words[WAKE_WORD_COUNT];
+std::atomic_bool static g_wake_word_claimed[WAKE_WORD_COUNT];
+
+/// Drain deadline settings
+std::atomic<long long> static g_drain_deadline_ns{0};
+std::atomic_int static g_drain_fallback_fd{STDERR_FILENO};
+
+/// Wakes the application thread that drains thread-less workers
+std::atomic<void (*)()> static g_signal_wake{nullptr};
+
+/// How long past the drain deadline to wait for a stuck sink (or drain thread)
+constexpr long long DRAIN_GRACE_NS = 1000000000LL;
+
 int get_signal_state() { return g_signal_state.load(); }
 
-void set_signal_state(int signal_id) { g_signal_state.store(signal_id); }
+void set_signal_state(int signal_id)
+{
+    g_signal_state.store(signal_id);
+    for (int i = 0; i < WAKE_WORD_COUNT; i++) {
+        if (g_wake_word_claimed[i].load()) {
+            g_wake_words[i]++;
+            futex_wake(g_wake_words[i], INT_MAX);
+        }
+    }
+}
+
+std::atomic<int>* claim_wake_word()
+{
+    for (int i = 0; i < WAKE_WORD_COUNT; i++) {
+        bool claimed = false;
+        if (g_wake_word_claimed[i].compare_exchange_strong(claimed, true)) {
+            return &g_wake_words[i];
+        }
+    }
+    return nullptr;
+}
 
-void notify_worker_stopping() { g_worker_stopped++; }
+void release_wake_word(std::atomic<int>* word)
+{
+    if (word) {
+        g_wake_word_claimed[word - g_wake_words].store(false);
+    }
+}
+
+void set_drain_deadline_ns(long long deadline_ns, int fallback_fd)
+{
+    g_drain_deadline_ns.store(deadline_ns);
+    g_drain_fallback_fd.store(fallback_fd);
+}
+
+long long get_drain_deadline_ns() { return g_drain_deadline_ns.load(); }
+
+int get_drain_fallback_fd() { return g_drain_fallback_fd.load(); }
+
+void notify_worker_stopping()
+{
+    g_worker_stopped++;
+    futex_wake(g_worker_stopped, INT_MAX);
+}
 
 void notify_worker_starting() { g_worker_started++; }
 
+void set_signal_wake(void (*wake)()) { g_signal_wake.store(wake); }
+
 void reset_worker_counts()
 {
     g_worker_started.store(0);
     g_worker_stopped.store(0);
 }
 
+static long long steady_ns()
+{
+    // steady_clock uses clock_gettime, which is async-signal-safe
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
 void block_until_all_workers_done()
 {
-    while (g_worker_stopped < g_worker_started) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    // The application thread that drains thread-less workers may be the one
+    // this handler interrupted, so never wait on it forever
+    long long deadline = g_drain_deadline_ns.load();
+    bool bounded = deadline > 0 || g_signal_wake.load() != nullptr;
+    long long give_up = bounded ? steady_ns() + std::max(deadline, 0LL) + DRAIN_GRACE_NS : 0;
+    for (int stopped = g_worker_stopped.load(); stopped < g_worker_started.load(); stopped = g_worker_stopped.load()) {
+        long long timeout = -1;
+        if (give_up) {
+            timeout = give_up - steady_ns();
+            if (timeout <= 0) {
+                break;
+            }
+        }
+        futex_wait(g_worker_stopped, stopped, timeout);
     }
     auto it = std::find(HANDLED_SIGNALS.begin(), HANDLED_SIGNALS.end(), g_signal_state.load());
     if (it != HANDLED_SIGNALS.end()) {
@@ -51,6 +132,10 @@ void block_until_all_workers_done()
 extern "C" void slog_handle_signal(int signal)
 {
     slog::set_signal_state(signal);
+    void (*wake)() = slog::g_signal_wake.load();
+    if (wake) {
+        wake();
+    }
     slog::block_until_all_workers_done();        
 }
 
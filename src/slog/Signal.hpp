@@ -1,5 +1,6 @@
 #pragma once
 #include <array>
+#include <atomic>
 
 namespace slog
 {
@@ -12,21 +13,48 @@ std::array<int, 3> extern const HANDLED_SIGNALS;
 int get_signal_state();
 
 /// Start handling the given signal. If this isn't SLOG_ACTIVE, the log workers
-/// will flush, and the logging threads will joint.
+/// will flush, and the logging threads will joint. Sleeping workers are woken
+/// through their wake words.
 void set_signal_state(int signal_id);
 
+/// Claim a futex word that set_signal_state() bumps and wakes, so that a worker
+/// sleeping on it notices a stop at once. Returns nullptr if none are left.
+std::atomic<int>* claim_wake_word();
+
+/// Give back a word from claim_wake_word()
+void release_wake_word(std::atomic<int>* word);
+
+/// Set how long workers may drain their queues after a stop or signal. Records
+/// still queued at the deadline are written raw to fallback_fd. Zero or
+/// negative deadlines wait as long as needed.
+void set_drain_deadline_ns(long long deadline_ns, int fallback_fd);
+
+/// Get the drain deadline in nanoseconds (zero or negative if unbounded)
+long long get_drain_deadline_ns();
+
+/// Get the descriptor for records that miss the drain deadline
+int get_drain_fallback_fd();
+
 /// Workers call this when they join their log threads
 void notify_worker_stopping();
 
 /// Workers call this when they start their log threads
 void notify_worker_starting();
 
+/// Set an async-signal-safe function for the signal handler to call after
+/// setting the signal state, to wake the application thread that drains
+/// workers without a thread of their own. While one is set, the handler waits
+/// at most a second past the drain deadline, even without a deadline. Pass
+/// nullptr to clear it.
+void set_signal_wake(void (*wake)());
+
 /// Reset the started/stopped counts
 void reset_worker_counts();
 
 /// Block until all workers have called notify_worker_done(). If get_signal_state()
 /// has one of HANDLED_SIGNALS, then the we will re-raise the signal with the default
-/// handler in place.
+/// handler in place. With a drain deadline (or a set_signal_wake() function),
+/// give up waiting a second after the deadline in case a sink is stuck.
 void block_until_all_workers_done();
 
 /// Extra "signal" codes that are special to slog
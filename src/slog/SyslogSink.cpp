@@ -18,6 +18,7 @@
 #include <cstdlib>
 #include <cstring>
 
+#include "LogContext.hpp"
 #include "LogSink.hpp"
 #include "PlatformUtilities.hpp"
 #include "SlogError.hpp"
@@ -38,6 +39,7 @@ SyslogSink::SyslogSink(char const* host, bool use_tcp)
 {    
     strncpy(destination, host, sizeof(destination) - 1);
     set_application_name(::slog::program_short_name());
+    set_structured_data_id("slog@32473");
     gethostname(hostname, sizeof(hostname) - 1);
 
     // Set up the FILE memory stream
@@ -299,17 +301,60 @@ int SyslogSink::format_header(LogRecord const& node)
         headerOffset = fprintf(buffer_stream, "<%d> %s %s %s: ", priority, timestamp, hostname, application_name);
     } else {
         node.meta().timestamp().format_time(timestamp);
-        headerOffset = fprintf(buffer_stream, "<%d>1 %s %s %s - %s - ", priority, timestamp, hostname, application_name,
+        headerOffset = fprintf(buffer_stream, "<%d>1 %s %s %s - %s ", priority, timestamp, hostname, application_name,
                                (node.meta().tag()[0] ? node.meta().tag() : "-"));
+        headerOffset += format_structured_data(node);
+        headerOffset += fprintf(buffer_stream, " ");
     }
     return headerOffset;
 }
 
+int SyslogSink::format_structured_data(LogRecord const& node)
+{
+    LogContext const* context = node.meta().context();
+    if (nullptr == context) {
+        return fprintf(buffer_stream, "-");
+    }
+    int size = fprintf(buffer_stream, "[%s", structured_data_id);
+    context->for_each([this, &size](char const* key, char const* value) {
+        // PARAM-NAME is up to 32 printable characters other than '=', ' ', ']' and '"'
+        fputc(' ', buffer_stream);
+        size++;
+        for (int i = 0; i < 32 && key[i]; i++) {
+            char c = key[i];
+            bool legal = c > ' ' && c < 127 && c != '=' && c != ']' && c != '"';
+            fputc(legal ? c : '_', buffer_stream);
+            size++;
+        }
+        fputs("=\"", buffer_stream);
+        size += 2;
+        // PARAM-VALUE escapes '"', '\\' and ']'
+        for (char const* c = value; *c; c++) {
+            if (*c == '"' || *c == '\\' || *c == ']') {
+                fputc('\\', buffer_stream);
+                size++;
+            }
+            fputc(*c, buffer_stream);
+            size++;
+        }
+        fputc('"', buffer_stream);
+        size++;
+    });
+    fputc(']', buffer_stream);
+    return size + 1;
+}
+
 void SyslogSink::set_application_name(char const* new_name)
 {
     strncpy(application_name, new_name, sizeof(application_name) - 1);
 }
 
+void SyslogSink::set_structured_data_id(char const* sd_id)
+{
+    strncpy(structured_data_id, sd_id, sizeof(structured_data_id) - 1);
+    structured_data_id[sizeof(structured_data_id) - 1] = '\0';
+}
+
 void SyslogSink::set_facility(int facility)
 {
     if (facility < 0) {
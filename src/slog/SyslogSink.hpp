@@ -17,6 +17,9 @@ namespace slog
  * syslog message is preceded by the byte count to be sent, e.g. "57 <12>
  * 2000-01-01T00:00:00Z mydomain.com my_app Hello World" for RFC3164 formatting.
  *
+ * In RFC5424 mode, the pairs of a record's LogContext are sent as a
+ * structured data element, e.g. [slog@32473 request="42"].
+ *
  * @note This can only send messages up to 64kB if the protocol is UDP/IP.
  * Longer messages will be silently truncated. Messages sent to a unix socket
  * via UDP or over TCP/IP do not have this limitation.
@@ -52,6 +55,13 @@ class SyslogSink : public LogSink
     /// Use RFC3164 format messages (default is RFC5424)
     void set_rfc3164_protocol(bool doit);
 
+    /**
+     * @brief Change the SD-ID of the RFC5424 structured data element holding
+     * LogContext pairs. Use "name@<your private enterprise number>". The
+     * default, slog@32473, uses the example number reserved by RFC5612.
+     */
+    void set_structured_data_id(char const* sd_id);
+
     /// Set the maximum connect tries before dropping a message (default is 10)
     void set_max_connection_attempts(int attempts);
 
@@ -80,6 +90,9 @@ class SyslogSink : public LogSink
     /// Write the syslog header into the buffer, returning the header size
     int format_header(LogRecord const& node);
 
+    /// Write the RFC5424 structured data for the record's context (or "-"), returning its size
+    int format_structured_data(LogRecord const& node);
+
     /// Connect to a unix socket
     bool connect_unix();
 
@@ -105,6 +118,7 @@ class SyslogSink : public LogSink
 
     char destination[1024];
     char application_name[64];
+    char structured_data_id[33];
     char hostname[1024];
     char timestamp[32];
     char* unix_socket;
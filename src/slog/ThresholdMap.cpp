@@ -1,5 +1,8 @@
 #include "ThresholdMap.hpp"
 #include "SlogConfig.hpp"
+#include "SlogError.hpp"
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 
@@ -71,6 +74,17 @@ int FlatThresholdMap::operator[](char const* tag) const
     return defaultThreshold;
 }
 
+int FlatThresholdMap::max_threshold() const
+{
+    int most = defaultThreshold;
+    for (unsigned long i = 0; i < mapSize; i++) {
+        if (map[i].threshold > most) {
+            most = map[i].threshold;
+        }
+    }
+    return most;
+}
+
 void FlatThresholdMap::add_tag(char const* tag, int threshold_)
 {
     // Check if this is a known tag
@@ -98,4 +112,95 @@ void FlatThresholdMap::add_tag(char const* tag, int threshold_)
     qsort(map, mapSize, sizeof(FlatThresholdMap::Threshold), map_sort);
 }
 
+namespace
+{
+constexpr unsigned long SLOT_COUNT = 2 * AtomicThresholdMap::MAX_TAGS; // A power of two
+
+/// FNV-1a over the characters strncmp(tag, ..., TAG_SIZE) would compare
+unsigned long hash_tag(char const* tag)
+{
+    uint32_t hash = 2166136261u;
+    for (unsigned long i = 0; i < TAG_SIZE && tag[i]; i++) {
+        hash = (hash ^ static_cast<unsigned char>(tag[i])) * 16777619u;
+    }
+    return hash;
+}
+} // namespace
+
+AtomicThresholdMap::AtomicThresholdMap(FlatThresholdMap const& initial)
+    : defaultThreshold(initial.defaultThreshold),
+      slots(new Slot[SLOT_COUNT]),
+      tagCount(0)
+{
+    for (unsigned long i = 0; i < SLOT_COUNT; i++) {
+        slots[i].ready.store(false, std::memory_order_relaxed);
+        slots[i].threshold.store(0, std::memory_order_relaxed);
+    }
+    for (unsigned long i = 0; i < initial.mapSize; i++) {
+        if (!set(initial.map[i].tag, initial.map[i].threshold)) {
+            slog_error("Only the first %lu tags of a channel are used\n", MAX_TAGS);
+            break;
+        }
+    }
+}
+
+AtomicThresholdMap::~AtomicThresholdMap() { delete[] slots; }
+
+AtomicThresholdMap::Slot* AtomicThresholdMap::find(char const* tag) const
+{
+    // The table is never more than half full, so this always ends
+    for (unsigned long i = hash_tag(tag);; i++) {
+        Slot& slot = slots[i & (SLOT_COUNT - 1)];
+        if (!slot.ready.load(std::memory_order_acquire) || 0 == strncmp(tag, slot.tag, TAG_SIZE)) {
+            return &slot;
+        }
+    }
+}
+
+int AtomicThresholdMap::operator[](char const* tag) const
+{
+    if (nullptr != tag && 0 != tag[0]) {
+        Slot const* slot = find(tag);
+        if (slot->ready.load(std::memory_order_relaxed)) {
+            return slot->threshold.load(std::memory_order_relaxed);
+        }
+    }
+    return defaultThreshold.load(std::memory_order_relaxed);
+}
+
+bool AtomicThresholdMap::set(char const* tag, int threshold_)
+{
+    if (nullptr == tag || 0 == tag[0]) {
+        defaultThreshold.store(threshold_, std::memory_order_relaxed);
+        return true;
+    }
+    // Store the tag as FlatThresholdMap::add_tag() does, so lookups match the same way
+    char stored[TAG_SIZE] = {};
+    strncpy(stored, tag, TAG_SIZE - 1);
+    Slot* slot = find(stored);
+    if (!slot->ready.load(std::memory_order_relaxed)) {
+        if (tagCount == MAX_TAGS) {
+            return false;
+        }
+        memcpy(slot->tag, stored, TAG_SIZE);
+        slot->threshold.store(threshold_, std::memory_order_relaxed);
+        slot->ready.store(true, std::memory_order_release);
+        tagCount++;
+        return true;
+    }
+    slot->threshold.store(threshold_, std::memory_order_relaxed);
+    return true;
+}
+
+int AtomicThresholdMap::max_threshold() const
+{
+    int most = defaultThreshold.load(std::memory_order_relaxed);
+    for (unsigned long i = 0; i < SLOT_COUNT; i++) {
+        if (slots[i].ready.load(std::memory_order_acquire)) {
+            most = std::max(most, slots[i].threshold.load(std::memory_order_relaxed));
+        }
+    }
+    return most;
+}
+
 } // namespace slog
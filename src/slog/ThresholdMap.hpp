@@ -1,5 +1,6 @@
 #pragma once
 #include "SlogConfig.hpp"
+#include <atomic>
 
 namespace slog
 {
@@ -40,6 +41,11 @@ class FlatThresholdMap
      */
     int operator[](char const* tag) const;
 
+    /**
+     * @brief The largest (most verbose) threshold of any tag or the default
+     */
+    int max_threshold() const;
+
   protected:
     // Function used to search the map
     static int map_compare(void const* vkey, void const* velement);
@@ -53,6 +59,8 @@ class FlatThresholdMap
     };
 
   private:
+    friend class AtomicThresholdMap;
+
     int defaultThreshold;
     Threshold* map;
     unsigned long mapSize;
@@ -60,4 +68,52 @@ class FlatThresholdMap
 };
 
 using ThresholdMap = FlatThresholdMap;
+
+/**
+ * @brief A char const* to int map that can be changed while other threads
+ * look tags up, without locks and without copying the map.
+ *
+ * Tags are kept in a fixed-size open-addressed table. A tag is written once
+ * and then published, and its threshold is an atomic changed in place, so
+ * nothing is ever freed while the map is in use. Tags are never removed, so
+ * at most MAX_TAGS distinct tags can be added.
+ */
+class AtomicThresholdMap
+{
+  public:
+    /// Distinct tags the map can hold. The table is kept at most half full.
+    static constexpr unsigned long MAX_TAGS = 128;
+
+    explicit AtomicThresholdMap(FlatThresholdMap const& initial);
+    ~AtomicThresholdMap();
+    AtomicThresholdMap(AtomicThresholdMap const&) = delete;
+    AtomicThresholdMap& operator=(AtomicThresholdMap const&) = delete;
+
+    /// Look up the threshold for the given tag, as FlatThresholdMap does. Thread safe.
+    int operator[](char const* tag) const;
+
+    /**
+     * @brief Set the threshold for a tag (the default if tag is null or
+     * empty). Calls must not overlap, but may overlap lookups. Returns false
+     * if the tag is new and the map already holds MAX_TAGS tags.
+     */
+    bool set(char const* tag, int threshold);
+
+    /// The largest (most verbose) threshold of any tag or the default. Thread safe.
+    int max_threshold() const;
+
+  private:
+    struct Slot {
+        std::atomic<bool> ready; // Set once tag is written
+        std::atomic<int> threshold;
+        char tag[TAG_SIZE];
+    };
+
+    /// The slot holding tag, or the empty slot where it belongs
+    Slot* find(char const* tag) const;
+
+    std::atomic<int> defaultThreshold;
+    Slot* slots;
+    unsigned long tagCount; // Only touched by set()
+};
 } // namespace slog
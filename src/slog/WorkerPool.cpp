@@ -0,0 +1,288 @@
+#include "WorkerPool.hpp"
+#include "PlatformUtilities.hpp"
+#include "Signal.hpp"
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <unistd.h>
+
+namespace slog
+{
+
+// Pooled workers do housekeeping (pool maintenance, drop reports, stale
+// stages) at least this often, like LogWorker's own WAIT.
+constexpr std::chrono::milliseconds TICK{50};
+
+namespace
+{
+long long steady_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+} // namespace
+
+std::atomic<WorkerPool*> WorkerPool::s_external{nullptr};
+
+WorkerPool::WorkerPool(int thread_count)
+    : thread_target(std::max(0, thread_count)),
+      tick_interval(TICK),
+      next_tick_ns(0),
+      wake_word(claim_wake_word()),
+      own_wake_word(0),
+      active_threads(0),
+      next_drain(0),
+      external(thread_count <= 0),
+      event(-1),
+      started(false),
+      busy(false),
+      drained(false)
+{
+    if (nullptr == wake_word) {
+        wake_word = &own_wake_word; // Stops are then noticed within TICK
+    }
+    if (external) {
+        event = open_event_fd();
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+    if (wake_word != &own_wake_word) {
+        release_wake_word(wake_word);
+    }
+    if (event >= 0) {
+        close(event);
+    }
+}
+
+void WorkerPool::set_thread_count(int count)
+{
+    assert(threads.empty() && !external);
+    thread_target = std::max(thread_target, count);
+}
+
+void WorkerPool::add_worker(std::shared_ptr<LogWorker> worker)
+{
+    assert(threads.empty());
+    long long delay_ns = worker->get_stage_delay_ns();
+    if (delay_ns > 0) {
+        tick_interval = std::min(tick_interval, std::chrono::milliseconds(std::max(1LL, delay_ns / 1000000)));
+    }
+    workers.push_back(std::move(worker));
+}
+
+void WorkerPool::start()
+{
+    if (external) {
+        if (!started) {
+            started = true;
+            drained.store(false);
+            notify_worker_starting();
+            s_external.store(this);
+            set_signal_wake(&WorkerPool::wake_external_on_signal);
+        }
+        return;
+    }
+    if (!threads.empty()) {
+        return;
+    }
+    next_tick_ns.store(steady_ns() + std::chrono::nanoseconds(tick_interval).count());
+    next_drain.store(0);
+    active_threads.store(thread_target);
+    for (int i = 0; i < thread_target; i++) {
+        notify_worker_starting();
+        threads.emplace_back([this]() {
+            thread_placement.apply();
+            work();
+        });
+    }
+}
+
+void WorkerPool::stop()
+{
+    if (external) {
+        if (started) {
+            if (get_signal_state() == SLOG_ACTIVE) {
+                set_signal_state(SLOG_STOPPED);
+            }
+            drain_external();
+            set_signal_wake(nullptr);
+            s_external.store(nullptr);
+            started = false;
+        }
+        return;
+    }
+    if (threads.empty()) {
+        return;
+    }
+    if (get_signal_state() == SLOG_ACTIVE) {
+        set_signal_state(SLOG_STOPPED);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+}
+
+void WorkerPool::schedule(LogWorker* worker)
+{
+    int state = worker->pool_state.load();
+    while (true) {
+        if (state == IDLE) {
+            if (worker->pool_state.compare_exchange_weak(state, READY)) {
+                enqueue(worker);
+                return;
+            }
+        } else if (state == RUNNING) {
+            if (worker->pool_state.compare_exchange_weak(state, RERUN)) {
+                return;
+            }
+        } else {
+            return; // Already due to run again
+        }
+    }
+}
+
+void WorkerPool::enqueue(LogWorker* worker)
+{
+    {
+        std::unique_lock<std::mutex> guard(ready_lock);
+        ready.push_back(worker);
+    }
+    if (external) {
+        post_event_fd(event);
+        return;
+    }
+    (*wake_word)++;
+    futex_wake(*wake_word, 1);
+}
+
+LogWorker* WorkerPool::next_ready(std::chrono::milliseconds wait)
+{
+    // Read the word before checking, so an enqueue after the check wakes us
+    int seen = wake_word->load();
+    std::unique_lock<std::mutex> guard(ready_lock);
+    if (ready.empty()) {
+        if (wait.count() <= 0) {
+            return nullptr;
+        }
+        guard.unlock();
+        futex_wait(*wake_word, seen, std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count());
+        guard.lock();
+        if (ready.empty()) {
+            return nullptr;
+        }
+    }
+    LogWorker* worker = ready.front();
+    ready.pop_front();
+    return worker;
+}
+
+void WorkerPool::finish(LogWorker* worker)
+{
+    int state = RUNNING;
+    if (!worker->has_queued() && worker->pool_state.compare_exchange_strong(state, IDLE)) {
+        return;
+    }
+    // More records, or some arrived while running
+    worker->pool_state.store(READY);
+    enqueue(worker);
+}
+
+void WorkerPool::tick()
+{
+    long long now = steady_ns();
+    long long due = next_tick_ns.load();
+    if (now < due ||
+        !next_tick_ns.compare_exchange_strong(due, now + std::chrono::nanoseconds(tick_interval).count())) {
+        return; // Not yet, or another thread is ticking
+    }
+    for (auto const& worker : workers) {
+        schedule(worker.get());
+    }
+}
+
+void WorkerPool::work()
+{
+    while (get_signal_state() == SLOG_ACTIVE) {
+        LogWorker* worker = next_ready(tick_interval);
+        if (worker) {
+            worker->pool_state.store(RUNNING);
+            worker->run_once(std::chrono::milliseconds(0));
+            finish(worker);
+        }
+        tick();
+    }
+
+    // Wait until no thread is still running a worker, then drain the workers
+    // in parallel
+    active_threads--;
+    futex_wake(active_threads, INT_MAX);
+    for (int active = active_threads.load(); active > 0; active = active_threads.load()) {
+        futex_wait(active_threads, active, -1);
+    }
+    for (std::size_t i = next_drain++; i < workers.size(); i = next_drain++) {
+        workers[i]->drain();
+    }
+    notify_worker_stopping();
+}
+
+std::size_t WorkerPool::run(std::size_t max_records, std::chrono::steady_clock::time_point deadline)
+{
+    if (!external) {
+        return 0;
+    }
+    if (get_signal_state() != SLOG_ACTIVE) {
+        // A signal handler is waiting for this thread to write what is queued
+        drain_external();
+        return 0;
+    }
+    if (busy.exchange(true)) {
+        return 0;
+    }
+    // Anything scheduled from here on posts the descriptor again
+    clear_event_fd(event);
+    tick();
+    std::size_t taken = 0;
+    while (taken < max_records && get_signal_state() == SLOG_ACTIVE &&
+           std::chrono::steady_clock::now() < deadline) {
+        LogWorker* worker = next_ready(std::chrono::milliseconds(0));
+        if (nullptr == worker) {
+            break;
+        }
+        worker->pool_state.store(RUNNING);
+        taken += worker->run_once(std::chrono::milliseconds(0), max_records - taken);
+        finish(worker);
+    }
+    busy.store(false);
+    return taken;
+}
+
+void WorkerPool::drain_external()
+{
+    if (drained.exchange(true)) {
+        return;
+    }
+    // A thread inside run() sees the stop after its current batch
+    while (busy.exchange(true)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    for (auto const& worker : workers) {
+        worker->drain();
+    }
+    busy.store(false);
+    notify_worker_stopping();
+}
+
+void WorkerPool::wake_external_on_signal()
+{
+    // Only async-signal-safe calls here. The thread calling drain() does the work.
+    WorkerPool* pool = s_external.load();
+    if (pool) {
+        post_event_fd(pool->event);
+    }
+}
+
+} // namespace slog
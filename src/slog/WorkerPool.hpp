@@ -0,0 +1,128 @@
+#pragma once
+#include "LogWorker.hpp"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace slog
+{
+
+/**
+ * @brief Threads shared by thread-less LogWorkers, one per pooled channel. See
+ * LogConfig::set_worker_pool().
+ *
+ * A worker with queued records goes on a shared run queue. Whichever pool
+ * thread is free takes it, writes one batch, and puts it back at the end of
+ * the run queue if records remain, so busy channels take turns. A worker is
+ * never run by two threads at once, so each channel's sink is still used by
+ * one thread at a time and its records stay in order.
+ *
+ * A pool with no threads is run by the application instead: run() writes
+ * records from its own event loop, and event_fd() becomes readable when there
+ * are records to write. See LogConfig::set_external_drain().
+ */
+class WorkerPool
+{
+  public:
+    /// Make a pool. Zero threads makes a pool that the application runs.
+    explicit WorkerPool(int thread_count);
+
+    /// Stops the pool
+    ~WorkerPool();
+
+    WorkerPool(WorkerPool const&) = delete;
+    WorkerPool& operator=(WorkerPool const&) = delete;
+
+    /// Raise the number of threads. Only call this before start().
+    void set_thread_count(int count);
+
+    /// Number of pool threads
+    int thread_count() const { return thread_target; }
+
+    /// Where the pool threads run and how they are scheduled. Only change this before start().
+    ThreadPlacement& placement() { return thread_placement; }
+
+    /// Add a worker (which should already have set_pool(this)). Only call this before start().
+    void add_worker(std::shared_ptr<LogWorker> worker);
+
+    /// Start the pool threads. If already started, this has no effect.
+    void start();
+
+    /**
+     * Drain every worker and join the pool threads. Like LogWorker::stop(),
+     * this stops all workers.
+     */
+    void stop();
+
+    /// Note that a worker has records to write. Thread safe.
+    void schedule(LogWorker* worker);
+
+    /// Descriptor that is readable while an application-run pool has work (-1 otherwise)
+    int event_fd() const { return event; }
+
+    /**
+     * Run an application-run pool until it has taken max_records records, the
+     * deadline passes, or nothing is queued. Returns the number of records
+     * taken. Returns 0 at once if another thread is running the pool.
+     */
+    std::size_t run(std::size_t max_records, std::chrono::steady_clock::time_point deadline);
+
+  private:
+    /// Worker run states
+    enum : int {
+        IDLE,    // Nothing queued
+        READY,   // On the run queue
+        RUNNING, // A pool thread is running it
+        RERUN    // Running, and records arrived meanwhile
+    };
+
+    /// Pool thread function
+    void work();
+
+    /// Wait up to wait for a ready worker. Returns nullptr on timeout or wake.
+    LogWorker* next_ready(std::chrono::milliseconds wait);
+
+    /// Put a worker on the run queue and wake a pool thread
+    void enqueue(LogWorker* worker);
+
+    /// Requeue a worker after running it if it has more to do, else idle it
+    void finish(LogWorker* worker);
+
+    /// If it is time, schedule every worker so that each does its housekeeping
+    void tick();
+
+    /// Drain the workers of an application-run pool after a stop (only once)
+    void drain_external();
+
+    /// Signal handler hook that wakes the thread running the application-run pool
+    static void wake_external_on_signal();
+
+    std::vector<std::shared_ptr<LogWorker>> workers;
+    std::vector<std::thread> threads;
+    int thread_target;
+    ThreadPlacement thread_placement;
+    std::chrono::milliseconds tick_interval;
+    std::atomic<long long> next_tick_ns;
+
+    std::mutex ready_lock;
+    std::deque<LogWorker*> ready;
+    std::atomic<int>* wake_word;    // Shared with the signal handler if possible
+    std::atomic<int> own_wake_word; // Fallback if no shared word was free
+
+    std::atomic<int> active_threads; // Pool threads that haven't started draining
+    std::atomic<std::size_t> next_drain;
+
+    // Application-run pools
+    bool const external;
+    int event;                               // eventfd posted when work is queued
+    bool started;                            // Set between start() and stop()
+    std::atomic<bool> busy;                  // Held by the thread running the pool
+    std::atomic<bool> drained;               // Set once drain_external() has begun
+    static std::atomic<WorkerPool*> s_external; // Woken by the signal handler
+};
+
+} // namespace slog
@@ -4,6 +4,8 @@
 #include "slog/Locale.hpp"
 #include <cstdarg>
 #include <cassert>
+#include <cstdio>
+#include <limits>
 #include <locale>
 
 namespace slog
@@ -11,6 +13,8 @@ namespace slog
 
 using Logger = ::slog::detail::Logger;
 
+std::atomic<int> g_verbosity_gate{std::numeric_limits<int>::max()};
+
 void start_logger(int severity)
 {
     LogConfig config;
@@ -26,7 +30,8 @@ void stop_logger()
 
 bool will_log(int severity, char const* tag, int channel)
 {
-    return severity <= Logger::get_channel(channel).threshold(tag);
+    LogChannel& log_channel = Logger::get_channel(channel);
+    return severity < log_channel.shed_limit() && severity <= log_channel.threshold(tag);
 }
 
 long free_record_count(int channel)
@@ -34,6 +39,31 @@ long free_record_count(int channel)
     return Logger::get_channel(channel).pool_free_count();
 }
 
+long dropped_record_count(int channel)
+{
+    return static_cast<long>(Logger::get_channel(channel).dropped_count(0, true));
+}
+
+void flush_thread()
+{
+    Logger::flush_thread();
+}
+
+bool flush(int channel, long timeout_ms)
+{
+    std::future<void> flushed = Logger::flush_async(channel);
+    if (timeout_ms < 0) {
+        flushed.wait();
+        return true;
+    }
+    return flushed.wait_for(std::chrono::milliseconds(timeout_ms)) == std::future_status::ready;
+}
+
+std::future<void> flush_async(int channel)
+{
+    return Logger::flush_async(channel);
+}
+
 void push_to_sink(LogRecord* node) 
 { 
     Logger::push_to_sink(node);
@@ -42,9 +72,15 @@ void push_to_sink(LogRecord* node)
 LogRecord* get_fresh_record(int channel, char const* file, char const* function, int line, int severity,
                             char const* tag)
 {
-    LogRecord* node = Logger::get_channel(channel).get_fresh_record();
+    // Records for unknown or removed channels go to the default channel
+    LogChannel& log_channel = Logger::get_channel(channel);
+    channel = Logger::live_channel(channel);
+    LogRecord* node = log_channel.get_fresh_record(severity);
     if (node) {
         node->meta().capture(file, function, line, severity, tag, channel);
+    } else if (line >= 0) {
+        // Jumbo record parts have no line. Those aren't whole records.
+        log_channel.count_drop(severity);
     }
     return node;
 }
@@ -66,7 +102,7 @@ LogRecord* capture_message(LogRecord* node, char const* format, ...)
 bool is_channel_active(int channel)
 {
     int channel_count = Logger::channel_count();
-    return (channel >= 0 && channel < channel_count);
+    return (channel >= 0 && channel < channel_count && Logger::live_channel(channel) == channel);
 }
 
 } // namespace slog
@@ -81,11 +117,16 @@ namespace slog {
 /**
  * @brief std::format log capture
  */
-void format_log(LogRecord* rec, std::string_view format, std::format_args args)
+void format_log(LogRecord* rec, std::string_view format, std::format_args args, long suppressed)
 {
     assert(rec);
     RecordInserter inserter(rec);
     std::vformat_to<RecordInserterIterator>(RecordInserterIterator(&inserter), get_locale(), format, args);
+    if (suppressed > 0) {
+        char suffix[32];
+        int length = snprintf(suffix, sizeof(suffix), " [%ld suppressed]", suppressed);
+        inserter.write(suffix, length);
+    }
 }
 } // namespace slog
 #endif
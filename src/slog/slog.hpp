@@ -1,6 +1,8 @@
 #pragma once
+#include "LogContext.hpp"
 #include "SlogConfig.hpp"
 #include "slogDetail.hpp"
+#include <future>
 
 #if SLOG_STREAM_LOG
 /**
@@ -28,6 +30,27 @@
 // Overload Slog() based on the argument count
 #define Slog(...) SLOG_GET_MACRO(__VA_ARGS__, SLOG_Logstc, SLOG_Logst, SLOG_Logs)(__VA_ARGS__)
 
+/**
+ * Sampled versions of Slog() for hot paths. Each call site keeps its own
+ * count, and suppressed occurrences cost no record. The next record let
+ * through ends with " [N suppressed]".
+ *
+ * ```
+ * SlogEvery(100, WARN) << "Logged on the 1st, 101st, 201st, ... time";
+ * SlogRate(5, 1000, ERRR, "net") << "At most 5 of these per second";
+ * SlogFirst(10, NOTE) << "The first 10, then the 11th, 12th, 14th, 18th, ...";
+ * ```
+ */
+#define SLOG_Sampleds(admit, severity) SLOG_LogStreamSampled(admit, slog::severity, "", slog::DEFAULT_CHANNEL)
+#define SLOG_Sampledst(admit, severity, tag) SLOG_LogStreamSampled(admit, slog::severity, (tag), slog::DEFAULT_CHANNEL)
+#define SLOG_Sampledstc(admit, severity, tag, channel) SLOG_LogStreamSampled(admit, slog::severity, (tag), (channel))
+#define SLOG_Sampled(admit, ...)                                                                                       \
+    SLOG_GET_MACRO(__VA_ARGS__, SLOG_Sampledstc, SLOG_Sampledst, SLOG_Sampleds)(admit, __VA_ARGS__)
+
+#define SlogEvery(n, ...) SLOG_Sampled(every_n(n), __VA_ARGS__)
+#define SlogRate(max_count, interval_ms, ...) SLOG_Sampled(rate((max_count), (interval_ms)), __VA_ARGS__)
+#define SlogFirst(n, ...) SLOG_Sampled(first_n(n), __VA_ARGS__)
+
 #endif
 
 #if SLOG_FORMAT_LOG
@@ -44,6 +67,22 @@
 
 // Overload Flog() based on the argument count
 #define Flog(...) SLOG_GET_MACRO(__VA_ARGS__, SLOG_Flogtc, SLOG_Flogt, SLOG_Flog)(__VA_ARGS__)
+
+/**
+ * Sampled std::format macros. These work like SlogEvery() and friends:
+ * ```
+ * FlogEvery(100, INFO)("Cache miss on {}", key);
+ * ```
+ */
+#define SLOG_FlogSampleds(admit, severity) SLOG_FlogSampled(admit, slog::severity, "", slog::DEFAULT_CHANNEL)
+#define SLOG_FlogSampledst(admit, severity, tag) SLOG_FlogSampled(admit, slog::severity, (tag), slog::DEFAULT_CHANNEL)
+#define SLOG_FlogSampledstc(admit, severity, tag, channel) SLOG_FlogSampled(admit, slog::severity, (tag), (channel))
+#define SLOG_FlogSampledAny(admit, ...)                                                                                \
+    SLOG_GET_MACRO(__VA_ARGS__, SLOG_FlogSampledstc, SLOG_FlogSampledst, SLOG_FlogSampleds)(admit, __VA_ARGS__)
+
+#define FlogEvery(n, ...) SLOG_FlogSampledAny(every_n(n), __VA_ARGS__)
+#define FlogRate(max_count, interval_ms, ...) SLOG_FlogSampledAny(rate((max_count), (interval_ms)), __VA_ARGS__)
+#define FlogFirst(n, ...) SLOG_FlogSampledAny(first_n(n), __VA_ARGS__)
 #endif
 
 #if SLOG_BINARY_LOG
@@ -74,6 +113,23 @@
 
 // Overload Blog() based on the argument count
 #define Blog(...) SLOG_GET_MACRO(__VA_ARGS__, SLOG_Blosgstc, SLOG_Blogst, SLOG_Blogs)(__VA_ARGS__)
+
+/**
+ * Sampled binary macros. These work like SlogEvery() and friends, except the
+ * suppressed count is not appended since it would corrupt the payload:
+ * ```
+ * BlogEvery(100, INFO, "pkt")(packet, packet_size);
+ * ```
+ */
+#define SLOG_BlogSampleds(admit, severity) SLOG_BlogSampled(admit, slog::severity, "", slog::DEFAULT_CHANNEL)
+#define SLOG_BlogSampledst(admit, severity, tag) SLOG_BlogSampled(admit, slog::severity, (tag), slog::DEFAULT_CHANNEL)
+#define SLOG_BlogSampledstc(admit, severity, tag, channel) SLOG_BlogSampled(admit, slog::severity, (tag), (channel))
+#define SLOG_BlogSampledAny(admit, ...)                                                                                \
+    SLOG_GET_MACRO(__VA_ARGS__, SLOG_BlogSampledstc, SLOG_BlogSampledst, SLOG_BlogSampleds)(admit, __VA_ARGS__)
+
+#define BlogEvery(n, ...) SLOG_BlogSampledAny(every_n(n), __VA_ARGS__)
+#define BlogRate(max_count, interval_ms, ...) SLOG_BlogSampledAny(rate((max_count), (interval_ms)), __VA_ARGS__)
+#define BlogFirst(n, ...) SLOG_BlogSampledAny(first_n(n), __VA_ARGS__)
 #endif
 
 #if SLOG_PRINTF_LOG
@@ -120,6 +176,42 @@ bool will_log(int severity, char const* tag = "", int channel = DEFAULT_CHANNEL)
  */
 long free_record_count(int channel = DEFAULT_CHANNEL);
 
+/**
+ * @brief Obtain the number of records dropped on the given channel because no
+ * record could be allocated.
+ *
+ * The worker also writes a summary of recent drops (by severity) to the sink
+ * as soon as the pool has a record to spare.
+ */
+long dropped_record_count(int channel = DEFAULT_CHANNEL);
+
+/**
+ * @brief Publish the records the calling thread has staged on any channel
+ * configured with LogConfig::set_thread_batching(). Other threads are not
+ * affected. This does not wait for the records to be written.
+ */
+void flush_thread();
+
+/**
+ * @brief Wait until every record queued on channel before this call has been
+ * written to the sink and the sink has been flushed.
+ *
+ * The calling thread's staged records (see flush_thread()) are published
+ * first. Records staged by other threads are not waited for. Never call this
+ * from a sink, since the worker would wait on itself.
+ *
+ * @param timeout_ms Give up after this many milliseconds. Negative values wait
+ * as long as it takes.
+ * @return False if the timeout expired first
+ */
+bool flush(int channel = DEFAULT_CHANNEL, long timeout_ms = -1);
+
+/**
+ * @brief Start a flush() of channel without waiting for it. The future is ready
+ * once the sink has been flushed.
+ */
+std::future<void> flush_async(int channel = DEFAULT_CHANNEL);
+
 /**
  * @brief True if channel is in use for logging messages
  */
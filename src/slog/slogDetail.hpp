@@ -1,6 +1,8 @@
 #pragma once
 #include "RecordInserter.hpp"
 #include "SlogConfig.hpp"
+#include <atomic>
+#include <chrono>
 
 #define SLOG_GET_MACRO(_1, _2, _3, NAME, ...) NAME
 
@@ -21,16 +23,130 @@ void push_to_sink(LogRecord* rec);
  */
 LogRecord* get_fresh_record(int channel, char const* file, char const* function, int line, int severity,
                             char const* tag);
+
+/**
+ * @brief The most verbose threshold on any channel or tag. The logger keeps
+ * this up to date (it is INT_MAX until there are channels).
+ */
+extern std::atomic<int> g_verbosity_gate;
+
+/**
+ * @brief Cheap check the macros make before will_log(). If this fails, no
+ * channel logs at severity, whatever the tag.
+ */
+inline bool passes_verbosity_gate(int severity) { return severity <= g_verbosity_gate.load(std::memory_order_relaxed); }
+
+class CallSite;
+
+/// The outcome of a CallSite check
+struct Admission {
+    CallSite* site;
+    long suppressed; // -1 to skip the occurrence, else the number skipped since the last one let through
+};
+
+/**
+ * @brief Sampling state for one logging call site. See SlogEvery(),
+ * SlogRate() and SlogFirst().
+ */
+class CallSite
+{
+  public:
+    CallSite()
+        : count(0),
+          suppressed(0),
+          next_ns(0)
+    {
+    }
+
+    /// Let through every nth occurrence, starting with the first
+    Admission every_n(long n)
+    {
+        unsigned long seen = count.fetch_add(1, std::memory_order_relaxed);
+        return (n <= 1 || seen % n == 0) ? pass() : suppress();
+    }
+
+    /// Let through the first n occurrences, then occurrences n, n+1, n+3, n+7, ...
+    Admission first_n(long n)
+    {
+        unsigned long seen = count.fetch_add(1, std::memory_order_relaxed);
+        if ((long)seen < n) {
+            return pass();
+        }
+        unsigned long gap = seen - (n > 0 ? n : 0) + 1;
+        return (gap & (gap - 1)) == 0 ? pass() : suppress();
+    }
+
+    /// Let through at most max_count occurrences per interval (a token bucket
+    /// holding max_count tokens, refilled at max_count per interval)
+    Admission rate(long max_count, long interval_ms)
+    {
+        long long now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now().time_since_epoch())
+                            .count();
+        long long interval_ns = interval_ms * 1000000LL;
+        long long step = max_count > 0 ? interval_ns / max_count : interval_ns;
+        long long tolerance = interval_ns - step;
+        // next_ns is when the bucket will be full again (the GCRA form of a token bucket)
+        long long due = next_ns.load(std::memory_order_relaxed);
+        while (true) {
+            long long start = due > now ? due : now;
+            if (max_count <= 0 || start - now > tolerance) {
+                return suppress();
+            }
+            if (next_ns.compare_exchange_weak(due, start + step, std::memory_order_relaxed)) {
+                return pass();
+            }
+        }
+    }
+
+    /// Count an occurrence that was let through but got no record, along
+    /// with the suppressed count it carried, so the next one reports them
+    void readmit(long carried) { suppressed.fetch_add(carried + 1, std::memory_order_relaxed); }
+
+  private:
+    Admission pass() { return Admission{this, (long)suppressed.exchange(0, std::memory_order_relaxed)}; }
+
+    Admission suppress()
+    {
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return Admission{this, -1};
+    }
+
+    std::atomic<unsigned long> count;
+    std::atomic<unsigned long> suppressed;
+    std::atomic<long long> next_ns;
+};
 } // namespace slog
 
+// The CallSite of the macro expanded here. Each expansion has its own lambda, and so its own state.
+#define SLOG_CALL_SITE ([]() -> slog::CallSite& {                                                                      \
+    static slog::CallSite slog_site_;                                                                                  \
+    return slog_site_;                                                                                                 \
+}())
+
+// Run the statement that follows once if the call site lets this occurrence
+// through, with its Admission in slog_admission_. Being a for loop, this
+// doesn't capture a dangling else. Suppressed occurrences never take a record.
+#define SLOG_SAMPLED(admit, will_log_check)                                                                            \
+    for (slog::Admission slog_admission_ = (SLOG_LOGGING_ENABLED && (will_log_check)) ? SLOG_CALL_SITE.admit           \
+                                                                                      : slog::Admission{nullptr, -1};  \
+         slog_admission_.suppressed >= 0; slog_admission_.suppressed = -1)
+
 #if SLOG_BINARY_LOG
 // Bseline binary logging macro. Only allocate and capture if the tag/severity
 // passes the threshold.
 #define SLOG_BlogBase(severity, tag, channel)                                                                          \
-    if (!(SLOG_LOGGING_ENABLED && slog::will_log((severity), (tag), (channel)))) {                                     \
+    if (!(SLOG_LOGGING_ENABLED && slog::passes_verbosity_gate(severity) &&                                             \
+          slog::will_log((severity), (tag), (channel)))) {                                                             \
     } else                                                                                                             \
         slog::CaptureBinary(slog::get_fresh_record((channel), __FILE__, __FUNCTION__, __LINE__, (severity), (tag)))
 
+// Sampled binary logging macro
+#define SLOG_BlogSampled(admit, severity, tag, channel)                                                                \
+    SLOG_SAMPLED(admit, slog::passes_verbosity_gate(severity) && slog::will_log((severity), (tag), (channel)))         \
+    slog::CaptureBinary(slog::get_fresh_record((channel), __FILE__, __FUNCTION__, __LINE__, (severity), (tag)),        \
+                        slog_admission_)
+
 namespace slog
 {
 
@@ -52,6 +168,12 @@ class CaptureBinary
      */
     CaptureBinary(LogRecord* node);
 
+    /**
+     * @brief Construct a capture object for a sampled call site. The payload
+     * is left as is, so the suppressed count is not reported.
+     */
+    CaptureBinary(LogRecord* node, Admission admission);
+
     /**
      * @brief Write bytes into the record
      * @param bytes -- Byte array
@@ -69,6 +191,14 @@ inline CaptureBinary::CaptureBinary(LogRecord* node)
 {
 }
 
+inline CaptureBinary::CaptureBinary(LogRecord* node, Admission admission)
+    : inserter(node)
+{
+    if (nullptr == node && admission.site) {
+        admission.site->readmit(admission.suppressed);
+    }
+}
+
 inline CaptureBinary& CaptureBinary::record(void const* message, long byte_count)
 {
     inserter.write(message, byte_count);
@@ -89,11 +219,20 @@ inline CaptureBinary& CaptureBinary::operator()(void const* bytes, long byte_cou
 // Baseline logging macro. Wrap the log check in an if() body, and get a stream
 // in the else clause (so that the << ... parts are on the else branch)
 #define SLOG_LogStreamBase(severity, tag, channel)                                                                     \
-    if (!(SLOG_LOGGING_ENABLED && slog::will_log((severity), (tag), (channel)))) {                                     \
+    if (!(SLOG_LOGGING_ENABLED && slog::passes_verbosity_gate(severity) &&                                             \
+          slog::will_log((severity), (tag), (channel)))) {                                                             \
     } else                                                                                                             \
         slog::CaptureStream(slog::get_fresh_record((channel), __FILE__, __FUNCTION__, __LINE__, (severity), (tag)))    \
             .stream()
 
+// Sampled logging macro. The << ... parts are only run for occurrences the
+// call site lets through.
+#define SLOG_LogStreamSampled(admit, severity, tag, channel)                                                           \
+    SLOG_SAMPLED(admit, slog::passes_verbosity_gate(severity) && slog::will_log((severity), (tag), (channel)))         \
+    slog::CaptureStream(slog::get_fresh_record((channel), __FILE__, __FUNCTION__, __LINE__, (severity), (tag)),        \
+                        slog_admission_)                                                                               \
+        .stream()
+
 namespace slog
 {
 
@@ -110,6 +249,10 @@ class CaptureStream
     /// Make a capture object that writes to node destined for channel_
     CaptureStream(LogRecord* node);
 
+    /// Make a capture object for a sampled call site. It notes how many
+    /// occurrences were suppressed (if any) at the end of the message.
+    CaptureStream(LogRecord* node, Admission admission);
+
     /// These are not copyable (this is enforced by inserter, but let's make it
     /// explicit)
     CaptureStream(CaptureStream const&) = delete;
@@ -126,6 +269,7 @@ class CaptureStream
   private:
     RecordInserter inserter;
     std::ostream* stream_ptr;
+    long suppressed;
 };
 } // namespace slog
 #endif
@@ -135,16 +279,24 @@ class CaptureStream
 #include <source_location>
 
 #define SLOG_FlogBase(severity, tag, channel)                                                                          \
-    if (!(SLOG_LOGGING_ENABLED && will_log((severity), (tag), (channel)))) {                                           \
+    if (!(SLOG_LOGGING_ENABLED && slog::passes_verbosity_gate(severity) &&                                             \
+          will_log((severity), (tag), (channel)))) {                                                                   \
     } else                                                                                                             \
         slog::CaptureFlog((severity), (tag), (channel))
 
+// Sampled std::format logging macro. The arguments are only formatted for
+// occurrences the call site lets through.
+#define SLOG_FlogSampled(admit, severity, tag, channel)                                                                \
+    SLOG_SAMPLED(admit, slog::passes_verbosity_gate(severity) && slog::will_log((severity), (tag), (channel)))         \
+    slog::CaptureFlog((severity), (tag), (channel), slog_admission_)
+
 namespace slog
 {
 /**
- * @brief std::vformat log capture. This assumes rec is not null.
+ * @brief std::vformat log capture. This assumes rec is not null. If
+ * suppressed is positive, " [N suppressed]" is appended.
  */
-void format_log(LogRecord* rec, std::string_view format, std::format_args args);
+void format_log(LogRecord* rec, std::string_view format, std::format_args args, long suppressed = 0);
 
 class CaptureFlog
 {
@@ -152,8 +304,20 @@ class CaptureFlog
     CaptureFlog(int severity, char const* tag = "", int channel_ = DEFAULT_CHANNEL,
                 std::source_location const& location = std::source_location::current())
         : rec(get_fresh_record(channel_, location.file_name(), location.function_name(), location.line(), severity,
-                               tag))
+                               tag)),
+          suppressed(0)
+    {
+    }
+
+    /// Capture for a sampled call site, noting how many occurrences were suppressed
+    CaptureFlog(int severity, char const* tag, int channel_, Admission admission,
+                std::source_location const& location = std::source_location::current())
+        : CaptureFlog(severity, tag, channel_, location)
     {
+        suppressed = admission.suppressed;
+        if (nullptr == rec && admission.site) {
+            admission.site->readmit(admission.suppressed);
+        }
     }
 
     /**
@@ -162,7 +326,7 @@ class CaptureFlog
     template <class... Args> void operator()(std::string_view format, Args&&... args)
     {
         if (rec) {
-            format_log(rec, format, std::make_format_args(unmove(args)...));
+            format_log(rec, format, std::make_format_args(unmove(args)...), suppressed);
         }
     }
 
@@ -171,6 +335,7 @@ class CaptureFlog
     template <class T> static T const& unmove(T&& t) { return t; }
 
     LogRecord* rec;
+    long suppressed;
 };
 
 } // namespace slog
@@ -179,7 +344,8 @@ class CaptureFlog
 #ifdef SLOG_PRINTF_LOG
 
 #define SLOG_PlogBase(severity, tag, channel, ...)                                                                     \
-    if ((SLOG_LOGGING_ENABLED && slog::will_log((severity), (tag), (channel)))) {                                      \
+    if ((SLOG_LOGGING_ENABLED && slog::passes_verbosity_gate(severity) &&                                              \
+          slog::will_log((severity), (tag), (channel)))) {                                                             \
         slog::LogRecord* record =                                                                                      \
             slog::get_fresh_record((channel), __FILE__, __FUNCTION__, __LINE__, (severity), (tag));                    \
         int bytes_maybe = snprintf(record->message(), record->capacity(), __VA_ARGS__);                                \
@@ -6,6 +6,7 @@
 
 #include "doctest.h"
 #include <csignal>
+#include "slog/GracePeriod.hpp"
 #include "slog/LogChannel.hpp"
 #include "slog/LogRecord.hpp"
 #include "slog/LogRecordPool.hpp"
@@ -16,6 +17,7 @@
 #include "slog/slog.hpp"
 #include "slog/slogDetail.hpp"
 #include <cstring>
+#include <thread>
 
 using namespace slog;
 
@@ -77,6 +79,260 @@ TEST_CASE("RecordPool.Allocate")
     CHECK(pool.count() == 2*total_message);
 }
 
+TEST_CASE("RecordPool.Mapped")
+{
+    int pool_size = 64 * 1024;
+    int message_size = 128;
+    LogRecordPool pool(DISCARD, pool_size, message_size, 50, MAPPED_MEMORY | HUGE_PAGES | PREFAULT);
+    long total_message = pool.count();
+    CHECK(total_message == pool_size / (message_size + sizeof(LogRecord)));
+    std::vector<LogRecord*> allocated;
+    for (long i = 0; i < total_message; i++) {
+        allocated.push_back(pool.allocate());
+        REQUIRE(allocated.back() != nullptr);
+        CHECK(allocated.back()->capacity() == message_size);
+        memset(allocated.back()->message(), 'x', message_size);
+    }
+    CHECK(pool.allocate() == nullptr);
+    for (auto r : allocated) { pool.free(r); }
+    CHECK(pool.count() == total_message);
+
+    // Records still out when a mapped pool dies let go of their context (the
+    // leak checker notices if they don't)
+    slog::LogContextScope scope("request", "7");
+    {
+        LogRecordPool doomed(DISCARD, pool_size, message_size, 50, MAPPED_MEMORY);
+        LogRecord* held = doomed.allocate();
+        REQUIRE(held != nullptr);
+        held->meta().capture("", "", 1, slog::INFO, "", 0);
+        CHECK(held->meta().context() == slog::LogContext::current());
+    }
+}
+
+TEST_CASE("RecordPool.Prefault")
+{
+    // Locking may fail without CAP_IPC_LOCK, but the pool must still work
+    LogRecordPool pool(BLOCK, 1024, 32, 10, PREFAULT | LOCK_MEMORY);
+    long total_message = pool.count();
+    for (long i = 0; i < total_message; i++) {
+        CHECK(pool.allocate() != nullptr);
+    }
+    CHECK(pool.allocate() == nullptr);
+}
+
+TEST_CASE("RecordPool.Stats")
+{
+    LogRecordPool pool(DISCARD, 1024, 32);
+    LogRecordPoolStats stats = pool.stats();
+    long capacity = pool.count();
+    CHECK(stats.capacity == capacity);
+    CHECK(stats.free == capacity);
+    CHECK(stats.in_use == 0);
+
+    // A jumbo record goes back in one piece
+    LogRecord* head = pool.allocate();
+    head->attach(pool.allocate())->attach(pool.allocate());
+    stats = pool.stats();
+    CHECK(stats.in_use == 3);
+    CHECK(stats.allocations == 3);
+    pool.free(head);
+    stats = pool.stats();
+    CHECK(stats.free == capacity);
+    CHECK(stats.high_water == 3);
+    CHECK(stats.jumbo_nodes == 2);
+
+    for (long i = 0; i < capacity; i++) {
+        CHECK(pool.allocate() != nullptr);
+    }
+    CHECK(pool.allocate() == nullptr);
+    stats = pool.stats();
+    CHECK(stats.free == 0);
+    CHECK(stats.high_water == capacity);
+    CHECK(stats.discards == 1);
+    CHECK(stats.blocks == 0);
+}
+
+TEST_CASE("RecordPool.Replenish")
+{
+    LogRecordPool pool(slog::ALLOCATE, 1024, 32);
+    long capacity = pool.count();
+    CHECK_FALSE(pool.replenish()); // Disabled by default
+    pool.set_low_watermark(capacity / 2);
+    CHECK_FALSE(pool.replenish()); // Above the watermark
+
+    std::vector<LogRecord*> allocated;
+    while (pool.count() >= capacity / 2) {
+        allocated.push_back(pool.allocate());
+    }
+    CHECK(pool.replenish());
+    LogRecordPoolStats stats = pool.stats();
+    CHECK(stats.capacity == 2 * capacity);
+    CHECK(stats.replenishments == 1);
+    CHECK(pool.count() >= capacity);
+    CHECK_FALSE(pool.replenish());
+    for (auto* record : allocated) {
+        pool.free(record);
+    }
+    CHECK(pool.count() == 2 * capacity);
+
+    LogRecordPool blocking(BLOCK, 1024, 32);
+    blocking.set_low_watermark(blocking.count() + 1);
+    CHECK_FALSE(blocking.replenish());
+}
+
+TEST_CASE("RecordPool.Trim")
+{
+    LogRecordPool pool(slog::ALLOCATE, 1024, 32);
+    long capacity = pool.count();
+    long chunk_bytes = pool.stats().footprint_bytes;
+    CHECK(chunk_bytes > 0);
+    CHECK(pool.trim() == 0); // The first chunk is kept
+
+    std::vector<LogRecord*> allocated;
+    for (long i = 0; i < 3 * capacity; i++) {
+        allocated.push_back(pool.allocate());
+    }
+    CHECK(pool.stats().footprint_bytes == 3 * chunk_bytes);
+    LogRecord* held = allocated.back(); // Pins the last chunk
+    allocated.pop_back();
+    for (auto* record : allocated) {
+        pool.free(record);
+    }
+    CHECK(pool.trim() == chunk_bytes);
+    LogRecordPoolStats stats = pool.stats();
+    CHECK(stats.footprint_bytes == 2 * chunk_bytes);
+    CHECK(stats.reclaimed_bytes == (uint64_t)chunk_bytes);
+    CHECK(stats.capacity == 2 * capacity);
+    CHECK(pool.count() == 2 * capacity - 1);
+
+    pool.free(held);
+    pool.set_low_watermark(capacity + 1);
+    CHECK(pool.trim() == 0); // Trimming would go below the watermark
+    pool.set_low_watermark(0);
+    CHECK(pool.trim() == chunk_bytes);
+    CHECK(pool.count() == capacity);
+    for (long i = 0; i < capacity; i++) {
+        CHECK(pool.allocate() != nullptr);
+    }
+}
+
+TEST_CASE("RecordPool.SoftCap")
+{
+    LogRecordPool pool(slog::ALLOCATE, 1024, 32);
+    long capacity = pool.count();
+    pool.set_soft_cap(pool.stats().footprint_bytes, WARN, DISCARD);
+    for (long i = 0; i < capacity; i++) {
+        CHECK(pool.allocate(INFO) != nullptr);
+    }
+    CHECK(pool.allocate(INFO) == nullptr);
+    CHECK(pool.stats().discards == 1);
+    CHECK(pool.allocate(ERRR) != nullptr); // Important records still grow the pool
+    CHECK(pool.stats().capacity == 2 * capacity);
+
+    pool.set_low_watermark(10 * capacity);
+    CHECK_FALSE(pool.replenish()); // Background growth respects the cap
+}
+
+TEST_CASE("RecordPool.Reserve")
+{
+    LogRecordPool pool(DISCARD, 1024, 32);
+    long capacity = pool.count();
+    long reserve = 4;
+    pool.set_reserve(reserve, WARN);
+    for (long i = 0; i < capacity - reserve; i++) {
+        CHECK(pool.allocate(DBUG) != nullptr);
+    }
+    CHECK(pool.allocate(DBUG) == nullptr);
+    CHECK(pool.allocate(INFO) == nullptr);
+    CHECK(pool.stats().refusals == 2);
+    for (long i = 0; i < reserve; i++) {
+        CHECK(pool.allocate(ERRR) != nullptr);
+    }
+    CHECK(pool.allocate(ERRR) == nullptr);
+    CHECK(pool.stats().refusals == 2);
+    CHECK(pool.stats().discards == 3);
+
+    // An important record is not stuck behind a blocked unimportant one
+    LogRecordPool blocking(BLOCK, 1024, 32, 1000);
+    blocking.set_reserve(1, WARN);
+    long blocking_capacity = blocking.count();
+    std::vector<LogRecord*> allocated;
+    for (long i = 0; i < blocking_capacity - 1; i++) {
+        allocated.push_back(blocking.allocate(DBUG));
+    }
+    auto start = std::chrono::steady_clock::now();
+    CHECK(blocking.allocate(CRIT) != nullptr);
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500));
+    std::thread freeing([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        blocking.free(allocated.back());
+        blocking.free(allocated.front());
+    });
+    CHECK(blocking.allocate(DBUG) != nullptr);
+    freeing.join();
+}
+
+TEST_CASE("RecordPool.FairBlocking")
+{
+    LogRecordPool pool(BLOCK, 1024, 32, 2000);
+    pool.set_fair_blocking();
+    long capacity = pool.count();
+    std::vector<LogRecord*> allocated;
+    for (long i = 0; i < capacity; i++) {
+        allocated.push_back(pool.allocate());
+    }
+
+    // Queue three waiters one after another, then free records one by one.
+    std::mutex order_lock;
+    std::vector<int> order;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 3; i++) {
+        threads.emplace_back([&, i]() {
+            LogRecord* record = pool.allocate();
+            CHECK(record != nullptr);
+            std::lock_guard<std::mutex> guard(order_lock);
+            order.push_back(i);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    for (int i = 0; i < 3; i++) {
+        pool.free(allocated[i]);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(order == std::vector<int>{0, 1, 2});
+
+    auto per_thread = pool.blocking_stats();
+    CHECK(per_thread.size() == 3);
+    for (auto const& entry : per_thread) {
+        CHECK(entry.blocks == 1);
+        CHECK(entry.blocked_ns > 0);
+        CHECK(entry.max_blocked_ns == entry.blocked_ns);
+    }
+    CHECK(pool.stats().blocks == 3);
+    CHECK(pool.stats().max_blocked_ns >= per_thread[0].max_blocked_ns);
+
+    // The waiting threads have exited
+    pool.maintain();
+    CHECK(pool.blocking_stats().empty());
+}
+
+TEST_CASE("RecordPool.BlockStats")
+{
+    LogRecordPool pool(BLOCK, 1024, 32, 10);
+    long capacity = pool.count();
+    for (long i = 0; i < capacity; i++) {
+        CHECK(pool.allocate() != nullptr);
+    }
+    CHECK(pool.allocate() == nullptr);
+    LogRecordPoolStats stats = pool.stats();
+    CHECK(stats.blocks == 1);
+    CHECK(stats.blocked_ns >= 10000000u);
+    CHECK(stats.discards == 1);
+}
+
 namespace
 {
 struct TestSink : public slog::LogSink {
@@ -110,6 +366,116 @@ TEST_CASE("LogChannel")
     CHECK(sink->finalized == 1);
 }
 
+namespace
+{
+struct Tracked {
+    explicit Tracked(std::atomic<int>& count_)
+        : count(count_)
+    {
+    }
+    ~Tracked() { count++; }
+    std::atomic<int>& count;
+};
+} // namespace
+
+TEST_CASE("GracePeriod")
+{
+    using slog::GracePeriod;
+    std::atomic<int> freed{0};
+
+    // Nobody is reading, so retiring frees at once
+    GracePeriod::retire(new Tracked(freed));
+    CHECK(freed == 1);
+
+    // A reader on another thread holds the object back until it leaves
+    std::atomic<bool> reading{false};
+    std::atomic<bool> release{false};
+    std::thread reader([&]() {
+        GracePeriod::ReadSection outer;
+        {
+            GracePeriod::ReadSection nested;
+        }
+        reading = true;
+        while (!release) {
+            std::this_thread::yield();
+        }
+    });
+    while (!reading) {
+        std::this_thread::yield();
+    }
+    GracePeriod::retire(new Tracked(freed));
+    GracePeriod::reclaim();
+    CHECK(freed == 1);
+    release = true;
+    reader.join();
+    GracePeriod::reclaim();
+    CHECK(freed == 2);
+
+    // synchronize() waits for the reader instead
+    reading = false;
+    release = false;
+    std::thread waiter([&]() {
+        GracePeriod::ReadSection section;
+        reading = true;
+        while (!release) {
+            std::this_thread::yield();
+        }
+    });
+    while (!reading) {
+        std::this_thread::yield();
+    }
+    GracePeriod::retire(new Tracked(freed));
+    std::thread releaser([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        release = true;
+    });
+    GracePeriod::synchronize();
+    CHECK(freed == 3);
+    waiter.join();
+    releaser.join();
+}
+
+TEST_CASE("AtomicThresholdMap")
+{
+    ThresholdMap initial;
+    initial.add_tag("foo", slog::NOTE);
+    initial.set_default(slog::WARN);
+    slog::AtomicThresholdMap map(initial);
+    CHECK(map["foo"] == slog::NOTE);
+    CHECK(map["bar"] == slog::WARN);
+    CHECK(map[""] == slog::WARN);
+    CHECK(map[nullptr] == slog::WARN);
+    CHECK(map.max_threshold() == slog::NOTE);
+
+    // Toggling a tag changes it in place
+    for (int i = 0; i < 1000; i++) {
+        CHECK(map.set("foo", i % 2 ? slog::DBUG : slog::ERRR));
+    }
+    CHECK(map["foo"] == slog::DBUG);
+    CHECK(map.set("", slog::INFO));
+    CHECK(map["bar"] == slog::INFO);
+    CHECK(map.max_threshold() == slog::DBUG);
+
+    // Long tags are truncated as in ThresholdMap
+    CHECK(map.set("abcdefghijklmnopqrstuvwxyz", slog::CRIT));
+    CHECK(map["abcdefghijklmno"] == slog::CRIT);
+
+    // Tags fill up
+    char tag[TAG_SIZE];
+    unsigned long added = 2;
+    for (; added < slog::AtomicThresholdMap::MAX_TAGS; added++) {
+        snprintf(tag, sizeof(tag), "tag%lu", added);
+        REQUIRE(map.set(tag, slog::ALRT));
+    }
+    CHECK_FALSE(map.set("one too many", slog::ALRT));
+    CHECK(map["one too many"] == slog::INFO);
+    CHECK(map.set("foo", slog::NOTE)); // Known tags can still change
+    for (added = 2; added < slog::AtomicThresholdMap::MAX_TAGS; added++) {
+        snprintf(tag, sizeof(tag), "tag%lu", added);
+        CHECK(map[tag] == slog::ALRT);
+    }
+}
+
 TEST_CASE("LoggerSingleton")
 {
     using Logger = slog::detail::Logger;
@@ -124,6 +490,15 @@ TEST_CASE("LoggerSingleton")
     CHECK(Logger::get_channel(1).threshold("") == slog::WARN);
     CHECK(Logger::get_channel(0).threshold("") == slog::DBUG);
     CHECK(Logger::get_channel(100).threshold("") == slog::DBUG);
+
+    slog::set_threshold(1, "noisy", slog::ERRR);
+    slog::set_default_threshold(1, slog::INFO);
+    CHECK(Logger::get_channel(1).threshold("noisy") == slog::ERRR);
+    CHECK(Logger::get_channel(1).threshold("") == slog::INFO);
+    CHECK(Logger::get_channel(0).threshold("noisy") == slog::DBUG);
+    slog::set_threshold(1, "noisy", slog::DBUG);
+    CHECK(Logger::get_channel(1).threshold("noisy") == slog::DBUG);
+    CHECK(Logger::get_channel(1).threshold("other") == slog::INFO);
 }
 
 TEST_CASE("LogRecord")
@@ -1,3 +1,4 @@
+#include "InMemorySink.hpp"
 #include "doctest.h"
 #include "slog/BinarySink.hpp"
 #include "slog/LogRecordPool.hpp"
@@ -205,4 +206,27 @@ TEST_CASE("Binary.jumbo")
     std::remove(logname);    
 }
 
+TEST_CASE("Binary.sampled")
+{
+    auto sink = std::make_shared<InMemorySink>();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_default_threshold(slog::INFO);
+    slog::start_logger(config);
+
+    char const* payload = "abcd";
+    int recorded = 0;
+    for (int i = 0; i < 10; i++) {
+        BlogEvery(4, INFO, "tag")(payload + recorded++ % 4, 1);
+        BlogFirst(1, INFO, "first", slog::DEFAULT_CHANNEL)(payload, 2);
+        BlogRate(1, 60000, DBUG)(payload, 4);
+    }
+    slog::stop_logger();
+
+    // The payloads aren't given a suppressed count
+    CHECK(recorded == 3);
+    std::vector<std::string> expected{"a", "ab", "ab", "ab", "b", "ab", "c", "ab"};
+    CHECK(sink->contents() == expected);
+}
+
 #endif
\ No newline at end of file
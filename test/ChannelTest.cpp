@@ -31,4 +31,63 @@ TEST_CASE("MultiChannel")
 
     REQUIRE(sink2->contents().size() == 1);
     CHECK(sink2->contents()[0] == "Recorded message to 1");
-}
\ No newline at end of file
+}
+
+TEST_CASE("MultiChannel.Numa")
+{
+    std::vector<slog::LogConfig> configs(2);
+    auto sink1 = std::make_shared<InMemorySink>();
+    configs[0].set_sink(sink1);
+    configs[0].set_default_threshold(slog::INFO);
+    configs[0].set_numa_pools();
+    configs[0].set_worker_numa_node(0);
+    auto sink2 = std::make_shared<InMemorySink>();
+    auto pool = std::make_shared<slog::LogRecordPool>(slog::DISCARD, 1024, 64);
+    long initial_free = pool->count();
+    configs[1].set_sink(sink2);
+    configs[1].set_default_threshold(slog::INFO);
+    configs[1].set_node_pools({pool, pool});
+    configs[1].set_worker_thread_id(1);
+
+    slog::start_logger(configs);
+    Slog(INFO, "tag", 0) << "Message to zero";
+    Slog(INFO, "tag", 1) << "Message to one";
+    slog::stop_logger();
+
+    REQUIRE(sink1->contents().size() == 1);
+    CHECK(sink1->contents()[0] == "Message to zero");
+    REQUIRE(sink2->contents().size() == 1);
+    CHECK(sink2->contents()[0] == "Message to one");
+    CHECK(pool->count() == initial_free);
+}
+
+TEST_CASE("MultiChannel.DropSummary")
+{
+    auto sink = std::make_shared<InMemorySink>();
+    auto pool = std::make_shared<slog::LogRecordPool>(slog::DISCARD, 0, 128);
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_pool(pool);
+    config.set_default_threshold(slog::INFO);
+    slog::start_logger(config);
+
+    // Exhaust the pool so that logging drops records
+    std::vector<slog::LogRecord*> held;
+    while (slog::LogRecord* record = pool->allocate()) {
+        held.push_back(record);
+    }
+    for (int i = 0; i < 5; i++) {
+        Slog(INFO, "tag") << "dropped info";
+    }
+    Slog(WARN, "tag") << "dropped warning";
+    Slog(WARN, "tag") << "dropped warning";
+    CHECK(slog::dropped_record_count() == 7);
+    for (auto* record : held) {
+        pool->free(record);
+    }
+    slog::stop_logger();
+
+    REQUIRE(sink->contents().size() == 1);
+    CHECK(sink->contents()[0].find("dropped 2 WARN / 5 INFO records in the last ") == 0);
+    CHECK(sink->tags()[0] == "slog");
+}
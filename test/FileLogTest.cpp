@@ -1,5 +1,6 @@
 #include "doctest.h"
 #include "slog/FileSink.hpp"
+#include "slog/LoggerSingleton.hpp"
 #include "slog/LogSetup.hpp"
 #include "slog/LogSink.hpp"
 #include "slog/Timestamp.hpp"
@@ -154,3 +155,111 @@ TEST_CASE("FileLog.rotation")
     std::remove(secondName.c_str());
     std::remove(firstname.c_str());
 }
+
+TEST_CASE("FileLog.parallel")
+{
+    auto sink = std::make_shared<slog::FileSink>();
+    sink->set_file(".", "parallel");
+    sink->set_formatter(slog::no_meta_format);
+    sink->set_echo(false);
+
+    slog::LogConfig config;
+    config.set_default_threshold(slog::DBUG);
+    config.set_sink(sink);
+    config.set_format_threads(4);
+    slog::start_logger(config);
+    int const count = 5000;
+    for (int i = 0; i < count; i++) {
+        Slog(INFO) << i;
+    }
+    slog::stop_logger();
+
+    FILE* f = fopen(sink->get_file_name(), "r");
+    REQUIRE(f);
+    char buffer[1024];
+    int expected = 0;
+    while (fgets(buffer, sizeof(buffer), f)) {
+        if (atoi(buffer) != expected) {
+            break;
+        }
+        expected++;
+    }
+    CHECK(expected == count);
+    fclose(f);
+    std::remove(sink->get_file_name());
+}
+
+TEST_CASE("FileLog.parallel.setSink")
+{
+    slog::LogConfig config;
+    config.set_default_threshold(slog::DBUG);
+    config.set_sink(std::make_shared<slog::NullSink>());
+    config.set_format_threads(4);
+    slog::start_logger(config);
+    CHECK_FALSE(slog::detail::Logger::get_channel(slog::DEFAULT_CHANNEL).formats_in_parallel());
+
+    // A sink that can format in parallel takes up the configured threads
+    auto sink = std::make_shared<slog::FileSink>();
+    sink->set_file(".", "parallelSwap");
+    sink->set_formatter(slog::no_meta_format);
+    sink->set_echo(false);
+    REQUIRE(slog::set_sink(slog::DEFAULT_CHANNEL, sink));
+    int const count = 1000;
+    for (int i = 0; i < count; i++) {
+        Slog(INFO) << i;
+    }
+    REQUIRE(slog::flush());
+    CHECK(slog::detail::Logger::get_channel(slog::DEFAULT_CHANNEL).formats_in_parallel());
+    slog::stop_logger();
+
+    FILE* f = fopen(sink->get_file_name(), "r");
+    REQUIRE(f);
+    char buffer[1024];
+    int expected = 0;
+    while (fgets(buffer, sizeof(buffer), f)) {
+        if (atoi(buffer) != expected) {
+            break;
+        }
+        expected++;
+    }
+    CHECK(expected == count);
+    fclose(f);
+    std::remove(sink->get_file_name());
+}
+
+TEST_CASE("FileLog.coalesce")
+{
+    auto sink = std::make_shared<slog::FileSink>();
+    sink->set_file(".", "coalesce");
+    sink->set_formatter(slog::no_meta_format);
+    sink->set_echo(false);
+
+    slog::LogConfig config;
+    config.set_default_threshold(slog::DBUG);
+    config.set_sink(sink);
+    config.set_format_threads(4);
+    config.set_duplicate_coalescing(true, 60000);
+    slog::start_logger(config);
+    int const count = 1000;
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < 3; j++) {
+            Slog(INFO) << i;
+        }
+    }
+    slog::stop_logger();
+
+    FILE* f = fopen(sink->get_file_name(), "r");
+    REQUIRE(f);
+    char buffer[1024];
+    int lines = 0;
+    while (fgets(buffer, sizeof(buffer), f)) {
+        if (lines % 2 == 0 ? atoi(buffer) != lines / 2
+                           : strcmp(buffer, "last message repeated 2 times\n") != 0) {
+            break;
+        }
+        lines++;
+    }
+    CHECK(lines == 2 * count);
+    fclose(f);
+    std::remove(sink->get_file_name());
+}
@@ -4,6 +4,7 @@
 #include <pthread.h>
 #include <unistd.h>
 
+#include "InMemorySink.hpp"
 #include "slog/FileSink.hpp"
 #include "slog/LogRecord.hpp"
 #include "slog/slog.hpp"
@@ -66,4 +67,26 @@ TEST_CASE("Flog")
     unlink(sink->get_file_name());
 }
 
+TEST_CASE("Flog.sampled")
+{
+    auto sink = std::make_shared<InMemorySink>();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_default_threshold(slog::INFO);
+    slog::start_logger(config);
+
+    int formatted = 0;
+    for (int i = 0; i < 7; i++) {
+        FlogEvery(3, INFO)("every {}", i);
+        FlogFirst(1, INFO, "tag")("first {}", i);
+        FlogRate(1, 60000, INFO, "", slog::DEFAULT_CHANNEL)("rate {}", formatted++);
+    }
+    slog::stop_logger();
+
+    CHECK(formatted == 1);
+    std::vector<std::string> expected{"every 0", "first 0", "rate 0", "first 1", "first 2", "every 3 [2 suppressed]",
+                                      "first 4 [1 suppressed]", "every 6 [2 suppressed]"};
+    CHECK(sink->contents() == expected);
+}
+
 #endif
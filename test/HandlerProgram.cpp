@@ -6,6 +6,8 @@
 #include <string>
 #include <functional>
 #include <csignal>
+#include <poll.h>
+#include <thread>
 
 std::shared_ptr<SlowSink> g_sink;
 
@@ -66,6 +68,27 @@ void term_test()
     raise(SIGTERM);    
 }
 
+void external_test()
+{
+    std::remove(SlowSink::file_name());
+    g_sink = std::make_shared<SlowSink>();
+    g_sink->unlock();
+    slog::LogConfig config(slog::DBUG, g_sink);
+    config.set_external_drain();
+    slog::start_logger(config);
+    // The event loop writes the queued record once the handler wakes it
+    std::thread loop([]() {
+        pollfd ready = {slog::event_fd(), POLLIN, 0};
+        while (true) {
+            poll(&ready, 1, 50);
+            slog::drain();
+        }
+    });
+    loop.detach();
+    Slog(NOTE) << "Test record";
+    raise(SIGINT);
+}
+
 int main(int argc, char** argv)
 {
     if (argc != 2) {
@@ -78,7 +101,8 @@ int main(int argc, char** argv)
         {"fatal", fatal_test},
         {"abort", abort_test},
         {"interrupt", interrupt_test},
-        {"term", term_test}
+        {"term", term_test},
+        {"external", external_test}
     };
     std::string requested_test(argv[1]);
     auto it = test.find(requested_test);
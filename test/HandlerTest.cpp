@@ -93,3 +93,17 @@ TEST_CASE("TermTest")
     fclose(f);
     std::remove(SlowSink::file_name());
 }
+
+TEST_CASE("ExternalDrainTest")
+{
+    int exit_code = run_test("external");
+    CHECK(exit_code == SIGINT);
+    FILE* f = fopen(SlowSink::file_name(), "r");
+    REQUIRE(f);
+    char buffer[1024];
+    CHECK(fgets(buffer, sizeof(buffer), f));
+    CHECK(strncmp(buffer, "Test record\n", 64) == 0);
+
+    fclose(f);
+    std::remove(SlowSink::file_name());
+}
@@ -44,4 +44,17 @@ TEST_CASE("PlatformUtilities.make_directory.strange")
     slog::rmdir("/tmp/slog");
     CHECK(slog::make_directory("/tmp/slog///"));
     slog::rmdir("/tmp/slog");
-}
\ No newline at end of file
+}
+
+TEST_CASE("PlatformUtilities.numa")
+{
+    int node_count = slog::numa_node_count();
+    CHECK(node_count >= 1);
+    std::vector<int> const& nodes = slog::numa_nodes();
+    REQUIRE(nodes.size() == (std::size_t)node_count);
+    int index = slog::current_numa_node_index();
+    REQUIRE(index >= 0);
+    REQUIRE(index < node_count);
+    CHECK(slog::current_numa_node() == nodes[index]);
+    CHECK_FALSE(slog::bind_thread_to_numa_node(nodes.back() + 1));
+}
@@ -9,8 +9,20 @@
 #include "slog/ThresholdMap.hpp"
 #include "slog/LoggerSingleton.hpp"
 #include "slog/slog.hpp"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 TEST_CASE("LogWorker")
 {
@@ -103,4 +115,1063 @@ TEST_CASE("LogWorker.twoThread")
     fclose(f);
     std::remove(fsink->get_file_name());
     std::remove(fsink2->get_file_name());
-}
\ No newline at end of file
+}
+namespace
+{
+/// A sink slow enough that producers outrun the pool
+class SluggishSink : public InMemorySink
+{
+  public:
+    void record(slog::LogRecord const& rec) override
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        InMemorySink::record(rec);
+    }
+};
+} // namespace
+
+TEST_CASE("Spill")
+{
+    auto sink = std::make_shared<SluggishSink>();
+    auto pool = std::make_shared<slog::LogRecordPool>(slog::SPILL, 0, 64);
+    long capacity = pool->count();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_pool(pool);
+    config.set_default_threshold(slog::DBUG);
+    slog::start_logger(config);
+
+    int const thread_count = 4;
+    int const message_count = 500;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.emplace_back([t]() {
+            for (int i = 0; i < message_count; i++) {
+                Slog(INFO, "spill") << t << " " << i;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    slog::stop_logger();
+
+    CHECK(pool->stats().spills > 0);
+    CHECK(pool->count() == capacity);
+    REQUIRE(sink->contents().size() == thread_count * message_count);
+    // Records from each thread arrive in order
+    std::vector<int> next(thread_count, 0);
+    for (std::size_t i = 0; i < sink->contents().size(); i++) {
+        int t = -1;
+        int n = -1;
+        REQUIRE(2 == sscanf(sink->contents()[i].c_str(), "%d %d", &t, &n));
+        REQUIRE(t >= 0);
+        REQUIRE(t < thread_count);
+        CHECK(n == next[t]);
+        next[t] = n + 1;
+        CHECK(sink->tags()[i] == "spill");
+    }
+}
+
+TEST_CASE("Spill.lanes")
+{
+    auto sink = std::make_shared<SluggishSink>();
+    auto pool = std::make_shared<slog::LogRecordPool>(slog::SPILL, 0, 64);
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_pool(pool);
+    config.set_default_threshold(slog::DBUG);
+    config.set_priority_lanes(slog::STRICT_PRIORITY);
+    slog::start_logger(config);
+
+    // Lanes may reorder severities, but each thread's records of one severity
+    // stay in order across spills
+    int const thread_count = 4;
+    int const message_count = 500;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.emplace_back([t]() {
+            for (int i = 0; i < message_count; i++) {
+                if (i % 2) {
+                    Slog(WARN, "spill") << t << " " << i;
+                } else {
+                    Slog(INFO, "spill") << t << " " << i;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    slog::stop_logger();
+
+    CHECK(pool->stats().spills > 0);
+    REQUIRE(sink->contents().size() == thread_count * message_count);
+    std::vector<int> next(2 * thread_count, 0);
+    next[1] = next[3] = next[5] = next[7] = 1;
+    for (std::string const& line : sink->contents()) {
+        int t = -1;
+        int n = -1;
+        REQUIRE(2 == sscanf(line.c_str(), "%d %d", &t, &n));
+        REQUIRE(t >= 0);
+        REQUIRE(t < thread_count);
+        CHECK(n == next[2 * t + n % 2]);
+        next[2 * t + n % 2] = n + 2;
+    }
+}
+
+TEST_CASE("Spill.unopenable")
+{
+    auto sink = std::make_shared<InMemorySink>();
+    auto pool = std::make_shared<slog::LogRecordPool>(slog::SPILL, 0, 64);
+    pool->set_spill_directory("/nonexistent/slog/spill");
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_pool(pool);
+    config.set_default_threshold(slog::DBUG);
+    slog::start_logger(config);
+
+    // Records that can neither be pooled nor spilled count as drops
+    int const message_count = 100;
+    for (int i = 0; i < message_count; i++) {
+        Slog(INFO) << i;
+    }
+    uint64_t dropped = slog::detail::Logger::get_channel(slog::DEFAULT_CHANNEL).dropped_count(slog::INFO);
+    slog::stop_logger();
+    // The sink also gets drop reports
+    uint64_t written = std::count_if(sink->contents().begin(), sink->contents().end(),
+                                     [](std::string const& line) { return std::to_string(atoi(line.c_str())) == line; });
+    CHECK(dropped > 0);
+    CHECK(written + dropped == message_count);
+}
+
+namespace
+{
+/// Holds the worker in the first record() call until released
+class GateSink : public InMemorySink
+{
+  public:
+    GateSink()
+        : entered(false),
+          open(false)
+    {
+    }
+
+    void record(slog::LogRecord const& rec) override
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        entered = true;
+        changed.notify_all();
+        changed.wait(guard, [this]() { return open; });
+        InMemorySink::record(rec);
+    }
+
+    void wait_until_entered()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this]() { return entered; });
+    }
+
+    void release()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        open = true;
+        changed.notify_all();
+    }
+
+  private:
+    std::mutex lock;
+    std::condition_variable changed;
+    bool entered;
+    bool open;
+};
+
+/// Log a backlog behind a stuck sink, then a CRIT. Return the CRIT's position in the output.
+std::size_t position_of_crit(slog::LogConfig& config, std::shared_ptr<GateSink> const& sink)
+{
+    config.set_sink(sink);
+    config.set_default_threshold(slog::DBUG);
+    slog::start_logger(config);
+    Slog(INFO, "") << "first";
+    sink->wait_until_entered();
+    for (int i = 0; i < 100; i++) {
+        Slog(DBUG, "") << i;
+    }
+    Slog(CRIT, "") << "alert";
+    sink->release();
+    slog::stop_logger();
+
+    auto const& contents = sink->contents();
+    REQUIRE(contents.size() == 102);
+    CHECK(contents[0] == "first");
+    return std::find(contents.begin(), contents.end(), "alert") - contents.begin();
+}
+} // namespace
+
+TEST_CASE("PriorityLanes")
+{
+    SUBCASE("fifo")
+    {
+        slog::LogConfig config;
+        CHECK(position_of_crit(config, std::make_shared<GateSink>()) == 101);
+    }
+    SUBCASE("strict")
+    {
+        slog::LogConfig config;
+        config.set_priority_lanes(slog::STRICT_PRIORITY);
+        CHECK(position_of_crit(config, std::make_shared<GateSink>()) == 1);
+    }
+    SUBCASE("weighted")
+    {
+        slog::LogConfig config;
+        config.set_priority_lanes(slog::WEIGHTED_PRIORITY, {slog::ERRR}, {1, 1});
+        CHECK(position_of_crit(config, std::make_shared<GateSink>()) <= 2);
+    }
+    SUBCASE("ordered")
+    {
+        slog::LogConfig config;
+        config.set_priority_lanes(slog::STRICT_PRIORITY);
+        config.set_preserve_order();
+        auto sink = std::make_shared<GateSink>();
+        std::size_t position = position_of_crit(config, sink);
+        CHECK(position > 1);
+        CHECK(position < 101);
+        for (std::size_t i = 2; i < position; i++) {
+            CHECK(std::stoi(sink->contents()[i]) == std::stoi(sink->contents()[i - 1]) + 1);
+        }
+    }
+}
+
+namespace
+{
+/// Sink that lets a test wait until some number of records have arrived
+class CountingSink : public InMemorySink
+{
+  public:
+    void record(slog::LogRecord const& rec) override
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        InMemorySink::record(rec);
+        arrived.notify_all();
+    }
+
+    /// Wait up to timeout for count records. Return the number that arrived.
+    std::size_t wait_for(std::size_t count, std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        arrived.wait_for(guard, timeout, [this, count]() { return mcontents.size() >= count; });
+        return mcontents.size();
+    }
+
+  private:
+    std::mutex lock;
+    std::condition_variable arrived;
+};
+} // namespace
+
+TEST_CASE("ThreadBatching")
+{
+    using std::chrono::milliseconds;
+    auto sink = std::make_shared<CountingSink>();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_default_threshold(slog::DBUG);
+    config.set_thread_batching(4, 60000);
+    slog::start_logger(config);
+
+    // Staged until the batch fills
+    for (int i = 0; i < 3; i++) {
+        Slog(INFO, "") << i;
+    }
+    CHECK(sink->wait_for(1, milliseconds(100)) == 0);
+    Slog(INFO, "") << 3;
+    CHECK(sink->wait_for(4, milliseconds(5000)) == 4);
+
+    // Severe records go at once, along with what came before them
+    Slog(INFO, "") << 4;
+    Slog(WARN, "") << 5;
+    CHECK(sink->wait_for(6, milliseconds(5000)) == 6);
+
+    // Explicit flushes
+    Slog(INFO, "") << 6;
+    slog::flush_thread();
+    CHECK(sink->wait_for(7, milliseconds(5000)) == 7);
+
+    // Thread exit
+    std::thread producer([]() { Slog(INFO, "") << 7; });
+    producer.join();
+    CHECK(sink->wait_for(8, milliseconds(5000)) == 8);
+
+    // Shutdown
+    Slog(INFO, "") << 8;
+    slog::stop_logger();
+    auto const& contents = sink->contents();
+    REQUIRE(contents.size() == 9);
+    for (int i = 0; i < 9; i++) {
+        CHECK(std::stoi(contents[i]) == i);
+    }
+
+    // The worker publishes stale stages
+    auto timed_sink = std::make_shared<CountingSink>();
+    config.set_sink(timed_sink);
+    config.set_thread_batching(100, 10);
+    slog::start_logger(config);
+    Slog(INFO, "") << "late";
+    CHECK(timed_sink->wait_for(1, milliseconds(5000)) == 1);
+    slog::stop_logger();
+}
+
+namespace
+{
+/// Gated sink that counts flushes
+class FlushCountingSink : public GateSink
+{
+  public:
+    FlushCountingSink()
+        : flushes(0)
+    {
+    }
+
+    void flush() override { flushes++; }
+
+    std::atomic<int> flushes;
+};
+} // namespace
+
+TEST_CASE("Flush")
+{
+    auto sink = std::make_shared<FlushCountingSink>();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_default_threshold(slog::DBUG);
+    config.set_priority_lanes(slog::WEIGHTED_PRIORITY, {slog::ERRR}, {1, 1});
+    slog::start_logger(config);
+    Slog(INFO, "") << "first";
+    sink->wait_until_entered();
+    for (int i = 0; i < 50; i++) {
+        Slog(DBUG, "") << i;
+    }
+    Slog(CRIT, "") << "alert";
+
+    CHECK_FALSE(slog::flush(slog::DEFAULT_CHANNEL, 20));
+    std::future<void> flushed = slog::flush_async();
+    sink->release();
+    CHECK(slog::flush());
+    CHECK(sink->contents().size() == 52);
+    flushed.wait();
+    CHECK(sink->flushes == 3); // The timed out flush still happens
+
+    slog::stop_logger();
+    CHECK(slog::flush(slog::DEFAULT_CHANNEL, 0));
+    CHECK(sink->flushes == 3);
+}
+
+namespace
+{
+/// Slow sink that remembers how many records had arrived at each sync
+class SyncCountingSink : public InMemorySink
+{
+  public:
+    void record(slog::LogRecord const& rec) override
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        std::unique_lock<std::mutex> guard(lock);
+        InMemorySink::record(rec);
+    }
+
+    void sync() override
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        synced.push_back(mcontents.size());
+    }
+
+    std::size_t synced_count()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        return synced.empty() ? 0 : synced.back();
+    }
+
+    std::size_t sync_calls()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        return synced.size();
+    }
+
+  private:
+    std::mutex lock;
+    std::vector<std::size_t> synced;
+};
+} // namespace
+
+TEST_CASE("LogWorker.syncAfterDrain")
+{
+    slog::stop_logger();
+    slog::LogWorker worker;
+    long alloc_size = 4 * (sizeof(slog::LogRecord) + 128);
+    auto pool = std::make_shared<slog::LogRecordPool>(slog::DISCARD, alloc_size, 128);
+    slog::ThresholdMap tmap;
+    tmap.set_default(slog::DBUG);
+    auto sink = std::make_shared<InMemorySink>();
+    worker.add_channel(0, std::make_shared<slog::LogChannel>(sink, tmap, pool));
+    long free_records = pool->count();
+    auto make_record = [&pool](char const* text) {
+        slog::LogRecord* record = pool->allocate();
+        record->meta().capture("", "", 1, slog::INFO, "", 0);
+        record->size(snprintf(record->message(), record->capacity(), "%s", text));
+        return record;
+    };
+
+    // A sync push that beats the drain is written by it
+    slog::LogCompletion completion;
+    std::thread early([&]() { worker.push_and_wait(make_record("early"), completion); });
+    while (!worker.has_queued()) {
+        std::this_thread::yield();
+    }
+    worker.drain();
+    early.join();
+    REQUIRE(sink->contents().size() == 1);
+    CHECK(sink->contents()[0] == "early");
+
+    // One that comes after is refused rather than left waiting
+    worker.push_and_wait(make_record("late"), completion);
+    CHECK(sink->contents().size() == 1);
+    CHECK(pool->count() == free_records);
+}
+
+TEST_CASE("SyncSeverity")
+{
+    auto sink = std::make_shared<SyncCountingSink>();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_default_threshold(slog::DBUG);
+    config.set_sync_severity(slog::ERRR);
+    slog::start_logger(config);
+
+    for (int i = 0; i < 20; i++) {
+        Slog(INFO, "") << i;
+    }
+    CHECK(sink->sync_calls() == 0);
+    Slog(ERRR, "") << "audit";
+    CHECK(sink->synced_count() == 21);
+
+    // Several waiting threads can share a sync
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; t++) {
+        producers.emplace_back([]() {
+            for (int i = 0; i < 10; i++) {
+                Slog(CRIT, "") << i;
+            }
+        });
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    CHECK(sink->synced_count() == 61);
+    CHECK(sink->sync_calls() <= 41);
+    slog::stop_logger();
+}
+
+namespace
+{
+/// Sink that takes a while with each record
+class DawdlingSink : public InMemorySink
+{
+  public:
+    void record(slog::LogRecord const& rec) override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        InMemorySink::record(rec);
+    }
+};
+
+long long milliseconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+} // namespace
+
+TEST_CASE("Shutdown")
+{
+    SUBCASE("prompt")
+    {
+        for (int i = 0; i < 5; i++) {
+            slog::LogConfig config;
+            config.set_sink(std::make_shared<InMemorySink>());
+            config.set_default_threshold(slog::DBUG);
+            slog::start_logger(config);
+            Slog(INFO, "") << "hello";
+            std::this_thread::sleep_for(std::chrono::milliseconds(5)); // Let the worker go to sleep
+            auto start = std::chrono::steady_clock::now();
+            slog::stop_logger();
+            CHECK(milliseconds_since(start) < 30);
+        }
+    }
+    SUBCASE("deadline")
+    {
+        int fallback[2];
+        REQUIRE(0 == pipe(fallback));
+        auto sink = std::make_shared<DawdlingSink>();
+        slog::LogConfig config;
+        config.set_sink(sink);
+        config.set_default_threshold(slog::DBUG);
+        slog::set_drain_deadline(20, fallback[1]);
+        slog::start_logger(config);
+        for (int i = 0; i < 200; i++) {
+            Slog(INFO, "") << "record " << i;
+        }
+        auto start = std::chrono::steady_clock::now();
+        slog::stop_logger();
+        slog::set_drain_deadline(0);
+        CHECK(milliseconds_since(start) < 200);
+        close(fallback[1]);
+
+        std::string dumped;
+        char buffer[4096];
+        for (ssize_t got = read(fallback[0], buffer, sizeof(buffer)); got > 0;
+             got = read(fallback[0], buffer, sizeof(buffer))) {
+            dumped.append(buffer, got);
+        }
+        close(fallback[0]);
+        std::size_t written = sink->contents().size();
+        CHECK(written < 200);
+        CHECK(std::count(dumped.begin(), dumped.end(), '\n') == 200 - (long)written);
+        CHECK(dumped.find("INFO record 199\n") != std::string::npos);
+    }
+    SUBCASE("spill deadline")
+    {
+        int fallback[2];
+        REQUIRE(0 == pipe(fallback));
+        auto sink = std::make_shared<DawdlingSink>();
+        auto pool = std::make_shared<slog::LogRecordPool>(slog::SPILL, 0, 64);
+        slog::LogConfig config;
+        config.set_sink(sink);
+        config.set_pool(pool);
+        config.set_default_threshold(slog::DBUG);
+        slog::set_drain_deadline(20, fallback[1]);
+        slog::start_logger(config);
+        {
+            slog::LogContextScope scope("request", "42"); // Spilled records hold a reference
+            for (int i = 0; i < 200; i++) {
+                Slog(INFO, "") << "record " << i;
+            }
+        }
+        slog::stop_logger();
+        slog::set_drain_deadline(0);
+        close(fallback[1]);
+
+        std::string dumped;
+        char buffer[4096];
+        for (ssize_t got = read(fallback[0], buffer, sizeof(buffer)); got > 0;
+             got = read(fallback[0], buffer, sizeof(buffer))) {
+            dumped.append(buffer, got);
+        }
+        close(fallback[0]);
+        CHECK(pool->stats().spills > 0);
+        // Spilled records whose replay was cut off are dumped too
+        std::size_t written = sink->contents().size();
+        CHECK(std::count(dumped.begin(), dumped.end(), '\n') == 200 - (long)written);
+    }
+}
+
+TEST_CASE("WorkerPool")
+{
+    constexpr int CHANNELS = 8;
+    constexpr int RECORDS = 200;
+    std::vector<std::shared_ptr<InMemorySink>> sinks;
+    std::vector<slog::LogConfig> config(CHANNELS);
+    for (int i = 0; i < CHANNELS; i++) {
+        sinks.push_back(std::make_shared<InMemorySink>());
+        config[i].set_sink(sinks.back());
+        config[i].set_default_threshold(slog::DBUG);
+        config[i].set_worker_pool(2);
+    }
+    slog::start_logger(config);
+    CHECK(slog::detail::Logger::worker_count() == 2);
+
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 2; t++) {
+        producers.emplace_back([t]() {
+            for (int i = 0; i < RECORDS; i++) {
+                for (int c = t; c < CHANNELS; c += 2) {
+                    Slog(INFO, "", c) << i;
+                }
+            }
+        });
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    CHECK(slog::flush(3));
+    CHECK(sinks[3]->contents().size() == RECORDS);
+    slog::stop_logger();
+
+    for (auto const& sink : sinks) {
+        REQUIRE(sink->contents().size() == RECORDS);
+        for (int i = 0; i < RECORDS; i++) {
+            CHECK(sink->contents()[i] == std::to_string(i));
+        }
+    }
+}
+
+namespace
+{
+/// Notes the name, scheduling and affinity of the thread writing records
+class PlacementSink : public InMemorySink
+{
+  public:
+    void record(slog::LogRecord const& rec) override
+    {
+        char buffer[16];
+        pthread_getname_np(pthread_self(), buffer, sizeof(buffer));
+        name = buffer;
+        policy = sched_getscheduler(0);
+        nice = getpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid));
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        sched_getaffinity(0, sizeof(cpus), &cpus);
+        cpu_count = CPU_COUNT(&cpus);
+        first_cpu = CPU_ISSET(0, &cpus);
+        InMemorySink::record(rec);
+    }
+
+    std::string name;
+    int policy = -1;
+    int nice = 0;
+    int cpu_count = 0;
+    bool first_cpu = false;
+};
+} // namespace
+
+TEST_CASE("WorkerPlacement")
+{
+    auto sink = std::make_shared<PlacementSink>();
+    auto default_sink = std::make_shared<PlacementSink>();
+    std::vector<slog::LogConfig> config(2);
+    config[0].set_sink(default_sink);
+    config[0].set_default_threshold(slog::DBUG);
+    config[1].set_sink(sink);
+    config[1].set_default_threshold(slog::DBUG);
+    config[1].set_worker_thread_id(1);
+    config[1].set_worker_cpus({0});
+    config[1].set_worker_scheduling(slog::BATCH_SCHEDULING, 5);
+    config[1].set_worker_name("logger-housekeeping");
+    slog::start_logger(config);
+    Slog(NOTE, "", 0) << "default";
+    Slog(NOTE, "", 1) << "placed";
+    slog::stop_logger();
+
+    REQUIRE(sink->contents().size() == 1);
+    CHECK(sink->name == "logger-housekee");
+    CHECK(sink->policy == SCHED_BATCH);
+    CHECK(sink->nice >= 5);
+    CHECK(sink->cpu_count == 1);
+    CHECK(sink->first_cpu);
+
+    REQUIRE(default_sink->contents().size() == 1);
+    CHECK(default_sink->name == "slog-0");
+    CHECK(default_sink->policy == SCHED_OTHER);
+}
+
+TEST_CASE("ExternalDrain")
+{
+    auto sink = std::make_shared<InMemorySink>();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_default_threshold(slog::DBUG);
+    config.set_external_drain();
+    slog::start_logger(config);
+    CHECK(slog::detail::Logger::worker_count() == 0);
+    int fd = slog::event_fd();
+    REQUIRE(fd >= 0);
+
+    for (int i = 0; i < 100; i++) {
+        Slog(INFO, "") << i;
+    }
+    pollfd event{fd, POLLIN, 0};
+    CHECK(poll(&event, 1, 1000) == 1);
+    CHECK(sink->contents().empty());
+    CHECK(slog::drain(10) == 10);
+    CHECK(sink->contents().size() == 10);
+    CHECK(poll(&event, 1, 0) == 1); // More to do
+    CHECK(slog::drain() == 90);
+    REQUIRE(sink->contents().size() == 100);
+    CHECK(sink->contents()[99] == "99");
+
+    // The rest is written at stop
+    for (int i = 100; i < 105; i++) {
+        Slog(INFO, "") << i;
+    }
+    slog::stop_logger();
+    CHECK(sink->contents().size() == 105);
+    CHECK(slog::event_fd() == -1);
+    CHECK(slog::drain() == 0);
+}
+
+TEST_CASE("RuntimeThreshold")
+{
+    auto sink = std::make_shared<InMemorySink>();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_default_threshold(slog::INFO);
+    slog::start_logger(config);
+    Slog(DBUG, "") << "hidden";
+
+    // Flip a tag while another thread logs with it
+    std::atomic<bool> done{false};
+    std::thread flipper([&done]() {
+        for (int i = 0; !done.load(); i++) {
+            slog::set_threshold(slog::DEFAULT_CHANNEL, "flip", i % 2 ? slog::DBUG : slog::ERRR);
+        }
+    });
+    for (int i = 0; i < 1000; i++) {
+        Slog(INFO, "flip") << "maybe";
+    }
+    done.store(true);
+    flipper.join();
+
+    slog::set_default_threshold(slog::DEFAULT_CHANNEL, slog::DBUG);
+    Slog(DBUG, "") << "shown";
+    slog::stop_logger();
+    REQUIRE(!sink->contents().empty());
+    CHECK(sink->contents().front() != "hidden");
+    CHECK(sink->contents().back() == "shown");
+}
+
+namespace
+{
+/// Counts finalize() calls
+class FinalizeCountingSink : public InMemorySink
+{
+  public:
+    void finalize() override { finalized++; }
+
+    std::atomic<int> finalized{0};
+};
+} // namespace
+
+TEST_CASE("LiveChannels")
+{
+    auto default_sink = std::make_shared<InMemorySink>();
+    slog::LogConfig config;
+    config.set_sink(default_sink);
+    config.set_default_threshold(slog::DBUG);
+    slog::start_logger(config);
+
+    auto first = std::make_shared<FinalizeCountingSink>();
+    slog::LogConfig added;
+    added.set_sink(first);
+    added.set_default_threshold(slog::DBUG);
+    int channel = slog::add_channel(added);
+    REQUIRE(channel == 1);
+    CHECK(slog::is_channel_active(channel));
+    CHECK(slog::detail::Logger::worker_count() == 2);
+    uint64_t shared_allocations = slog::pool_stats(slog::DEFAULT_CHANNEL).allocations;
+    for (int i = 0; i < 20; i++) {
+        Slog(INFO, "", channel) << "first " << i;
+    }
+    // The added channel shares the default pool
+    CHECK(slog::pool_stats(slog::DEFAULT_CHANNEL).allocations == shared_allocations + 20);
+
+    auto second = std::make_shared<FinalizeCountingSink>();
+    CHECK(slog::set_sink(channel, second));
+    Slog(INFO, "", channel) << "second";
+    CHECK(slog::flush(channel));
+    CHECK(first->contents().size() == 20);
+    CHECK(first->finalized == 1);
+    REQUIRE(second->contents().size() == 1);
+    CHECK(second->contents()[0] == "second");
+
+    CHECK_FALSE(slog::remove_channel(slog::DEFAULT_CHANNEL));
+    CHECK(slog::remove_channel(channel));
+    CHECK_FALSE(slog::remove_channel(channel));
+    CHECK_FALSE(slog::is_channel_active(channel));
+    Slog(INFO, "", channel) << "rerouted";
+    CHECK(slog::flush(slog::DEFAULT_CHANNEL));
+    CHECK(second->finalized == 1);
+    REQUIRE(default_sink->contents().size() == 1);
+    CHECK(default_sink->contents()[0] == "rerouted");
+
+    slog::stop_logger();
+    CHECK(slog::add_channel(added) == -1);
+    CHECK(second->contents().size() == 1);
+}
+
+namespace
+{
+/// Threads in this process
+int thread_count()
+{
+    int count = 0;
+    DIR* tasks = opendir("/proc/self/task");
+    if (tasks) {
+        while (dirent* entry = readdir(tasks)) {
+            count += entry->d_name[0] != '.';
+        }
+        closedir(tasks);
+    }
+    return count;
+}
+} // namespace
+
+TEST_CASE("LiveChannels.churn")
+{
+    auto sink = std::make_shared<InMemorySink>();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_default_threshold(slog::DBUG);
+    slog::start_logger(config);
+
+    // Log to channels as they come and go. Each add or remove replaces the
+    // channel table under the logging thread.
+    std::atomic<int> newest{0};
+    std::atomic<bool> done{false};
+    std::thread producer([&]() {
+        while (!done) {
+            Slog(INFO, "", newest.load()) << "churn";
+        }
+    });
+    int threads = thread_count();
+    for (int i = 0; i < 50; i++) {
+        slog::LogConfig added;
+        added.set_sink(std::make_shared<InMemorySink>());
+        added.set_default_threshold(slog::DBUG);
+        int channel = slog::add_channel(added);
+        REQUIRE(channel == i + 1);
+        newest = channel;
+        CHECK(slog::remove_channel(channel));
+    }
+    // Removed channels take their worker threads with them
+    CHECK(thread_count() == threads);
+    done = true;
+    producer.join();
+    CHECK(slog::detail::Logger::channel_count() == 51);
+    Slog(NOTE) << "last";
+    slog::stop_logger();
+    REQUIRE_FALSE(sink->contents().empty());
+    CHECK(sink->contents().back() == "last");
+}
+
+TEST_CASE("VerbosityGate")
+{
+    auto sink = std::make_shared<InMemorySink>();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_default_threshold(slog::NOTE);
+    config.add_tag("chatty", slog::INFO);
+    slog::start_logger(config);
+    CHECK(slog::g_verbosity_gate.load() == slog::INFO);
+    CHECK_FALSE(slog::passes_verbosity_gate(slog::DBUG));
+
+    slog::set_threshold(slog::DEFAULT_CHANNEL, "chatty", slog::DBUG);
+    CHECK(slog::g_verbosity_gate.load() == slog::DBUG);
+    slog::set_threshold(slog::DEFAULT_CHANNEL, "chatty", slog::WARN);
+    CHECK(slog::g_verbosity_gate.load() == slog::NOTE);
+
+    slog::LogConfig verbose;
+    verbose.set_sink(std::make_shared<InMemorySink>());
+    verbose.set_default_threshold(slog::DBUG);
+    int channel = slog::add_channel(verbose);
+    CHECK(slog::g_verbosity_gate.load() == slog::DBUG);
+    slog::remove_channel(channel);
+    CHECK(slog::g_verbosity_gate.load() == slog::NOTE);
+
+    Slog(INFO, "chatty") << "hidden";
+    Slog(NOTE) << "shown";
+    slog::stop_logger();
+    REQUIRE(sink->contents().size() == 1);
+    CHECK(sink->contents()[0] == "shown");
+}
+
+TEST_CASE("Sampling")
+{
+    auto sink = std::make_shared<InMemorySink>();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_default_threshold(slog::INFO);
+    slog::start_logger(config);
+
+    for (int i = 0; i < 10; i++) {
+        SlogEvery(3, INFO) << "every " << i;
+        SlogEvery(3, DBUG) << "below threshold " << i;
+    }
+    for (int i = 0; i < 10; i++) {
+        SlogFirst(2, INFO, "tag") << "first " << i;
+    }
+    int evaluated = 0;
+    for (int i = 0; i < 10; i++) {
+        SlogRate(2, 60000, INFO, "", slog::DEFAULT_CHANNEL) << "rate " << evaluated++;
+    }
+    bool took_else = false;
+    if (false)
+        SlogEvery(1, INFO) << "dangling";
+    else
+        took_else = true;
+    slog::stop_logger();
+
+    CHECK(took_else);
+    CHECK(evaluated == 2);
+    std::vector<std::string> expected{"every 0",
+                                      "every 3 [2 suppressed]",
+                                      "every 6 [2 suppressed]",
+                                      "every 9 [2 suppressed]",
+                                      "first 0",
+                                      "first 1",
+                                      "first 2",
+                                      "first 3",
+                                      "first 5 [1 suppressed]",
+                                      "first 9 [3 suppressed]",
+                                      "rate 0",
+                                      "rate 1"};
+    CHECK(sink->contents() == expected);
+}
+
+TEST_CASE("Sampling.noRecord")
+{
+    auto sink = std::make_shared<InMemorySink>();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_default_threshold(slog::INFO);
+    auto pool = std::make_shared<slog::LogRecordPool>(slog::DISCARD, 8 * (sizeof(slog::LogRecord) + 128), 128);
+    config.set_pool(pool);
+    slog::start_logger(config);
+
+    // Occurrences 0 and 2 are let through while the pool is empty
+    std::vector<slog::LogRecord*> held;
+    while (auto* rec = pool->allocate()) {
+        held.push_back(rec);
+    }
+    for (int i = 0; i < 6; i++) {
+        if (4 == i) {
+            for (auto* rec : held) {
+                pool->free(rec);
+            }
+        }
+        SlogEvery(2, INFO) << "every " << i;
+    }
+    slog::stop_logger();
+
+    std::vector<std::string> logged;
+    for (auto const& line : sink->contents()) {
+        if (line.compare(0, 6, "every ") == 0) {
+            logged.push_back(line);
+        }
+    }
+    std::vector<std::string> expected{"every 4 [4 suppressed]"};
+    CHECK(logged == expected);
+}
+
+TEST_CASE("DuplicateCoalescing")
+{
+    auto sink = std::make_shared<InMemorySink>();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_default_threshold(slog::INFO);
+    config.set_duplicate_coalescing(true, 60000);
+    slog::start_logger(config);
+
+    for (int i = 0; i < 5; i++) {
+        Slog(INFO) << "storm";
+    }
+    Slog(INFO) << "storm"; // Same text, different call site
+    for (int i = 0; i < 3; i++) {
+        Slog(INFO) << "storm " << (i < 2 ? 0 : 1);
+    }
+    for (int i = 0; i < 3; i++) {
+        Slog(INFO) << "tail";
+    }
+    slog::stop_logger();
+
+    std::vector<std::string> expected{"storm",
+                                      "last message repeated 4 times",
+                                      "storm",
+                                      "storm 0",
+                                      "last message repeated 1 times",
+                                      "storm 1",
+                                      "tail",
+                                      "last message repeated 2 times"};
+    CHECK(sink->contents() == expected);
+}
+
+TEST_CASE("LoadShedding")
+{
+    auto sink = std::make_shared<GateSink>();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_default_threshold(slog::DBUG);
+    config.set_pool(std::make_shared<slog::LogRecordPool>(slog::DISCARD, 256 * (1024 + sizeof(slog::LogRecord)), 1024));
+    config.set_load_shedding(0.7, 0.2, 0);
+    slog::start_logger(config);
+
+    Slog(INFO) << "first";
+    sink->wait_until_entered();
+    for (int i = 0; i < 1000; i++) {
+        Slog(INFO) << i;
+    }
+    CHECK(slog::will_log(slog::DBUG));
+    sink->release();
+    // The worker steps back down once the backlog is gone
+    for (int i = 0; i < 200 && !(slog::flush() && slog::will_log(slog::DBUG)); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    CHECK(slog::will_log(slog::DBUG));
+    slog::stop_logger();
+
+    std::vector<std::string> shifts;
+    for (auto const& message : sink->contents()) {
+        if (message.compare(0, 14, "load shedding:") == 0) {
+            shifts.push_back(message.substr(0, message.find(" (")));
+        }
+    }
+    REQUIRE(shifts.size() >= 2);
+    CHECK(shifts.front() == "load shedding: dropping records less severe than INFO");
+    CHECK(shifts.back() == "load shedding: ended");
+}
+
+namespace
+{
+/// Sink that appends each record's rendered context to its message
+class ContextSink : public InMemorySink
+{
+  public:
+    void record(slog::LogRecord const& rec) override
+    {
+        InMemorySink::record(rec);
+        slog::FormatBuffer buffer;
+        slog::write_context_to_file(buffer.file(), rec);
+        mcontents.back().append(buffer.data(), buffer.size());
+    }
+};
+} // namespace
+
+TEST_CASE("LogContext")
+{
+    auto sink = std::make_shared<ContextSink>();
+    slog::LogConfig config;
+    config.set_sink(sink);
+    config.set_default_threshold(slog::INFO);
+    slog::start_logger(config);
+
+    Slog(INFO) << "none";
+    {
+        slog::LogContextScope request{{"request", 7}, {"path", std::string("/index")}};
+        Slog(INFO) << "outer";
+        {
+            slog::LogContextScope user("user", "bob");
+            Slog(INFO) << "inner";
+            std::thread other([]() { Slog(INFO) << "other thread"; });
+            other.join();
+        }
+        Slog(INFO) << "outer again";
+    }
+    Slog(INFO) << "none again";
+    CHECK(nullptr == slog::LogContext::current());
+    slog::stop_logger();
+
+    std::vector<std::string> expected{"none",
+                                      "outer request=7 path=/index",
+                                      "inner request=7 path=/index user=bob",
+                                      "other thread",
+                                      "outer again request=7 path=/index",
+                                      "none again"};
+    CHECK(sink->contents() == expected);
+}